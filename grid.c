@@ -5,6 +5,7 @@
  * This is a text-editor
  * Note: I tested the functionality on Apple's default Terminal
  */
+#define _GNU_SOURCE // memmem() on glibc
 #include <termios.h> // terminal of the screen
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,14 +13,48 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h> // strncasecmp()
+#include <poll.h>
+#include <time.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/inotify.h> // follow mode, elsewhere it looks at the file size on a timer
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // SSE2/AVX2 search, picked at runtime
+#endif
+
+struct LINE;
 
 // function headers
 int		tty_raw(int fd);
 int		tty_reset(int fd); 
 void	clear_screen();
-void	handle_input(char c);
+void	handle_input(int c);
 void	sig_catch(int signo);
-int		get_file_size(char* file_name);
+void	sig_winch(int signo);
+long	get_file_size(char* file_name);
+void	load_wait(int row);
+void	load_start(char *from);
+void	load_cancel();
+int		prompt_active();
+void	pager_draw();
+void	pager_key(int c);
+void	pager_watch();
+void	print_summary(const char *name, long file_size, long lines);
+void	hl_edit(int row);
+void	hl_rows(int row, int delta);
+void	win_rows(int row, int delta);
+int		hl_begin(int top, int limit);
+int		hl_color(struct LINE *line, int state, unsigned char *pens, int from, int n);
 
 /* error checking method */
 void die(char *str){
@@ -31,409 +66,5314 @@ void die(char *str){
 // new structure to implement buffer and cursors
 struct LINE{ // each line keep their own string and length of the string
 	int len;
+	int cap; // bytes allocated for str, 0 when str is not ours (points into file_map, or NULL)
+	int gap; // gap buffer: text is str[0, gap) + str[gap + cap - len, cap), free space in between
+	unsigned char dirty : 1; // not what the file has on this line anymore: edited, split, joined or new
+	unsigned char ascii : 1; // no byte >= 0x80, so a byte is a column. Good while measured is set
+	unsigned char measured : 1; // ascii and width are right, until the text changes
+	unsigned char hl; // lexer state at the end of the line, only good for rows above hl_valid
+	unsigned short width; // columns it takes on screen, WIDTH_MAX if that many or more
 	char *str;
 };
 
+#define NODE_MAX 128 // lines per leaf and children per inner node of the line tree
+
+struct NODE{ // line tree: a B+tree over line numbers, every node caches how many lines it holds
+	int count; // lines in this subtree
+	int n; // slots used in kids or lines
+	int leaf;
+	struct NODE *prev, *next; // leaves only, chained in line order for walking the file
+	union{
+		struct{ // inner node
+			struct NODE *kids[NODE_MAX];
+			int counts[NODE_MAX]; // counts[i] == kids[i]->count, kept here so line_at() scans one array
+		};
+		struct LINE lines[NODE_MAX]; // leaf: the LINEs themselves, inline and contiguous
+	};
+};
+
 struct CURPOR{ // cusor position
 	int row;
 	int col;
 };
 
+struct VIEWPORT{ // which part of the buffer is on screen
+	int top; // buffer row shown on screen row 0
+	int left; // column shown on screen column 0
+};
+
 // global variables for switching TERM modes
 static struct termios save_termios;
 static int ttysavefd = -1;
 static enum { RESET, RAW } ttystate = RESET;
-static FILE *file_write_to; 
 
-// global variables for buffer system
-struct LINE **buffer = NULL; // char[file_rows][file_columns]
-int file_rows = 0; // keep track of max file rows --- or max file lines
-int buf_line_no = 0; // switch from file_rows to buf_line_no after print_buffer()
+struct PAINT;
+struct PARKED;
+
+struct DOC{ // an open file: its line tree and the map under it, shared by every window on it
+	char *name;
+	struct NODE *buffer; // root of the line tree, line_at(buffer, row) is char[row][...]
+	int file_rows; // keep track of max file rows --- or max file lines, as loaded
+	int buf_line_no; // lines in the buffer right now, follows add_rows()/del_rows()
+	char *file_map; // the file, mapped read-only, NULL when it is empty or new
+	size_t file_map_size;
+	int (*hl_lex)(const char *s, int n, int state, struct PAINT *out); // NULL: all plain
+	int hl_valid; // rows above this have the right state in ->hl
+	int hl_from; // rows edited since the last frame, none while hl_from > hl_to
+	int hl_to;
+	struct PARKED *parked; // its journal and undo while another document has the keys
+	struct DOC *next;
+};
+
+struct WIN{ // a window: one view of a document, on a band of screen rows
+	struct DOC *doc;
+	struct CURPOR cur; // now I can manipulater with win->cur.row win->cur.col, index based 0
+	struct VIEWPORT view; // scrolls so cur always stays on screen
+	int top; // first screen row
+	int rows; // rows of text, a bar with the name below them when there are more windows
+	struct WIN *next; // the window under it
+};
+
+// global variables for buffer system and cursor positions
+struct DOC *docs = NULL; // every open file, the first one is from the command line
+struct WIN *wins = NULL; // windows top to bottom
+struct DOC *doc = NULL; // what the code below edits, draws and searches: the document of win
+struct WIN *win = NULL; // the window that has the keys, or the one being drawn
+static char status_line[512]; // shown on the bottom row while it isn't empty, the text gets one less
 
-// global variables for cursor positions
-static struct CURPOR CUTE = {0, 0}; // now I can manipulater with CUTE.row CUTE.col, index based 0
+// draw or lex in w for a moment, returns the window to go back to
+static struct WIN *win_use(struct WIN *w){
+	struct WIN *was = win;
+	win = w;
+	doc = w->doc;
+	return was;
+}
 
 /*-------------------------------| BUFFER SYSTEM func() |--------------------------------------*/
-// allocate memory from file to buffer here... | so far, no logic error as far as I can see
-void file_to_buffer(FILE *fp, int file_size){
-	char c;
-	buffer = (struct LINE **) malloc(sizeof(struct LINE *) * 0); // first starting out with nothing to use realloc later
-	while (file_size > 0){
-		struct LINE **temp = (struct LINE **) realloc(buffer, (++file_rows) * sizeof(struct LINE *));
-		if (temp == NULL){
-			for (int i = 0; i < file_rows - 1; i++) // - 1 here because of the above, so we don't get segmentation
-            	free(buffer[i]); // free char* /columns allocated prior
-    
-			free(buffer);
-			die("Initial allocation failed");
-		}
-		buffer = temp; // now we can reassign the pointer after error check %%%%
-
-		int line_len = 0;
-		char *idv_line = (char *) malloc(sizeof(char) * 0); // first starting out so can use realloc later
-		while ((c = fgetc(fp)) != '\n' && c != '\0' && c != EOF) {
-			char *temp = (char *) realloc(idv_line, sizeof(char) * (line_len + 1));
-			if (temp == NULL){ 
-				free(idv_line); 
-				die("Failed at file_to_buffer()");
-			}
-			idv_line = temp; // now allocated the memory for the idv_line here ...
-			idv_line[line_len++] = c; // now assign the character to this exact spot, -1 because 0-based index
-			file_size--;
-		} // end of inside while loop
-		if (c == EOF) break; // in the worst case
-		
-		struct LINE *line = (struct LINE *) malloc(sizeof(struct LINE));
-		if (line == NULL){
-			free(idv_line);
-			die("Failed at file_to_buffer()");
-		}
-		line->len = line_len;
-		line->str = idv_line; // now LINE *line should be filled with info, ready for LINE **
-
-		buffer[file_rows - 1] = line; // now we can assign the line to that spot, really O(n^2)
-	} // end of main while loop
-}
-
-// write from buffer to file
-void buffer_to_file(struct LINE **obj, char *filename){
-	FILE *fp = fopen(filename, "wb");
-
-	for (int i = 0; i < buf_line_no; i++){
-		char *s = obj[i]->str;
-		int len = obj[i]->len;
-		int byte_read = fwrite(s, sizeof(char), len, fp);
-		if (byte_read != len) die("Error writing buffer to file");
-		fputc('\n', fp);
-	}
-
-	printf("Completed buffer_to_file\n");
+// piece table, one piece per line: the file stays mapped read-only and a loaded line is just
+// a (str, len) slice of file_map with cap == 0. A line gets its own gap buffer the first time it
+// is edited, so opening copies nothing and memory only grows with what was edited.
+double load_ms = 0; // time spent in the last file_to_buffer(), until the loader is done for _bg()
+double first_ms = 0; // what file_to_buffer_bg() took before it returned
+#define LOAD_FIRST 4096 // lines file_to_buffer_bg() reads itself, more than any screen shows
+double save_ms = 0; // time spent in the last buffer_to_file(), fsync included
+long long save_bytes = 0; // bytes it wrote
+
+// wall clock in ms, only used to measure things
+static double now_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/*-------------------------------| STATS - counters on the hot paths, make stats |-----------------*/
+/* built with -DGRID_STATS (make stats builds grid-stats) the hot paths count their calls and the
+ * time spent in them: key decoding, the four buffer mutations, the frame diff and its write(),
+ * the frame as a whole. The buffer's allocators count what they hand out. CTRL-T shows an overlay
+ * with the last frame and the memory, and the table comes out at exit. Without the flag these are
+ * empty functions, the numbers stay 0 and neither CTRL-T nor the table is there */
+#define STAT_RSS_MS 250 // /proc/self/statm gets read at most this often for the overlay
+
+enum STAT{
+	ST_DECODE, // input_key()
+	ST_ADD_COLS,
+	ST_DEL_COLS,
+	ST_ADD_ROWS,
+	ST_DEL_ROWS,
+	ST_DIFF, // frame_send() without the write()
+	ST_FLUSH, // ab_flush(), the write()
+	ST_FRAME, // refresh_screen(), everything
+	ST_ALLOC, // slab slots, big strs and reallocs of the buffer, counted only
+	ST_COUNT
+};
+
+struct STAT_SLOT{
+	long long n;
+	double ms;
+};
+
+static struct STAT_SLOT stats[ST_COUNT];
+#ifdef GRID_STATS
+static const char *stat_names[ST_COUNT] = {"decode", "add_cols", "del_cols", "add_rows", "del_rows",
+	"diff", "flush", "frame", "alloc"};
+#endif
+static double stat_frame_ms = 0; // the last frame, for the overlay
+static long long stat_frame_bytes = 0;
+static int stats_shown = 0; // CTRL-T
+
+static double stat_start(){
+#ifdef GRID_STATS
+	return now_ms();
+#else
+	return 0;
+#endif
+}
+
+static void stat_stop(int k, double start){
+#ifdef GRID_STATS
+	stats[k].n++;
+	stats[k].ms += now_ms() - start;
+#endif
+}
+
+static void stat_count(int k){
+#ifdef GRID_STATS
+	stats[k].n++;
+#endif
+}
+
+// end of a frame that began at start and wrote bytes
+static void stat_frame(double start, long long bytes){
+#ifdef GRID_STATS
+	stat_stop(ST_FRAME, start);
+	stat_frame_ms = now_ms() - start;
+	stat_frame_bytes = bytes;
+#endif
+}
+
+// resident memory in bytes, 0 where there is no /proc/self/statm
+static long long stat_rss(){
+	long long size, rss = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp == NULL) return 0;
+	if (fscanf(fp, "%lld %lld", &size, &rss) != 2) rss = 0;
 	fclose(fp);
+	return rss * sysconf(_SC_PAGESIZE);
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/* slab arena: tree nodes, so every LINE header as they sit inline in the leaves, and line payloads
+ * up to SLAB_MAX bytes are carved out of 1MB blocks. Freed slots go on a free list per size class
+ * and the whole lot goes back to the system in one sweep over the blocks at teardown */
+#define ARENA_BLOCK (1 << 20)
+#define SLAB_MIN 16 // payload classes are 16, 32, 64, 128, 256 bytes
+#define SLAB_MAX 256
+#define SLAB_NODE 5 // class of tree nodes, right after the payload classes
+
+static char *arena_block = NULL; // block being carved, its first bytes point to the previous one
+static size_t arena_used = ARENA_BLOCK; // bytes of arena_block handed out, "full" so the first take allocates
+static void *slab_free[SLAB_NODE + 1]; // freed slots of each class, linked through their first bytes
+static long big_strs = 0; // payloads over SLAB_MAX, malloc'd on their own
+
+static void *arena_take(size_t size){
+	size = (size + 15) & ~(size_t) 15;
+	if (arena_used + size > ARENA_BLOCK){
+		char *block = (char *) malloc(ARENA_BLOCK);
+		if (block == NULL) die("Failed at arena_take()");
+		*(char **) block = arena_block;
+		arena_block = block;
+		arena_used = 16;
+	}
+	void *p = arena_block + arena_used;
+	arena_used += size;
+	return p;
 }
 
-// this function only print the whole buffer, not singular line, not recommended for performance reason
-// to clear a whole line and then reprint everything ...
-void print_buffer(struct LINE **buffer, int file_rows) {
-	// reason why it is file_rows - 1, is because file_rows when read really start at 1
-    for (int i = 0; i < file_rows - 1; i++) {
-		for (int j = 0; j < buffer[i]->len; j++){
-			putchar(buffer[i]->str[j]);
-		}
-		putchar('\n');
-		buf_line_no++; // switch to buf_line_no as a way to keep track of how many lines there are
-    }
+static void *slab_alloc(int cls, size_t size){
+	stat_count(ST_ALLOC);
+	void *p = slab_free[cls];
+	if (p == NULL) return arena_take(size);
+	slab_free[cls] = *(void **) p;
+	return p;
 }
 
-// now delete memories used
-void free_buffer(struct LINE ***obj){
-	if (*obj == NULL) return;
+static void slab_release(int cls, void *p){
+	*(void **) p = slab_free[cls];
+	slab_free[cls] = p;
+}
 
-	// switch to buf_line_no as a way to keep track of how many lines there are
-	for (int i = 0; i < buf_line_no; i++){
-		if ((*obj)[i] != NULL) {
-			free((*obj)[i]->str); // Free str inside LINE
-			free((*obj)[i]); // Free LINE
-		}
+// a block carved by someone else (the loader thread) joins the chain behind the one being carved
+static void arena_adopt(char *block){
+	if (arena_block == NULL){
+		*(char **) block = NULL;
+		arena_block = block;
+		arena_used = ARENA_BLOCK; // full, nothing more gets carved from it here
+		return;
 	}
+	*(char **) block = *(char **) arena_block;
+	*(char **) arena_block = block;
+}
 
-	free(*obj); // free buffer now
+// give every block back at once
+static void arena_free_all(){
+	while (arena_block != NULL){
+		char *prev = *(char **) arena_block;
+		free(arena_block);
+		arena_block = prev;
+	}
+	arena_used = ARENA_BLOCK;
+	memset(slab_free, 0, sizeof(slab_free));
 }
 
-// add more columns --- which means add more characters to a line
-void add_cols(struct LINE *obj, char c, int pos){
-	if (obj->len < 0) return; 
+// cap is a power of two, small ones map to slab classes 0..4
+static int slab_class(int cap){
+	int cls = 0;
+	while ((SLAB_MIN << cls) < cap) cls++;
+	return cls;
+}
 
-	if (pos < 0 || pos > obj->len) return; // if not in limit, do nothing and return
+static char *str_alloc(int cap){
+	if (cap <= SLAB_MAX) return (char *) slab_alloc(slab_class(cap), cap);
 
-	char *str = obj->str; // point to str space // will have another allocate str func
-	
-	char *temp = (char *) realloc(str, (obj->len + 1) * sizeof(char));
-	if (temp == NULL){
-		free(obj->str);
-		die("Initial allocation failed");
+	stat_count(ST_ALLOC);
+	char *str = (char *) malloc(cap);
+	if (str == NULL) die("Failed at str_alloc()");
+	big_strs++;
+	return str;
+}
+
+static void str_free(char *str, int cap){
+	if (cap == 0) return; // not ours
+	if (cap <= SLAB_MAX) slab_release(slab_class(cap), str);
+	else{
+		free(str);
+		big_strs--;
 	}
-	obj->str = temp;
+}
 
-	memmove(obj->str + pos + 1, obj->str + pos, obj->len - pos); // move by the position to add char
+// text after the gap, len - gap bytes long
+static char *line_tail(struct LINE *obj){
+	return obj->str + obj->gap + (obj->cap - obj->len);
+}
 
-	obj->str[pos] = c;
+// copy n chars of the line starting at from into dst, stepping over the gap
+static void line_copy(struct LINE *obj, int from, int n, char *dst){
+	if (from < obj->gap){
+		int head = obj->gap - from < n ? obj->gap - from : n;
+		memcpy(dst, obj->str + from, head);
+		dst += head;
+		from += head;
+		n -= head;
+	}
+	if (n > 0) memcpy(dst, line_tail(obj) + (from - obj->gap), n);
+}
 
-	obj->len++;
+// make room for extra more chars, capacity doubles so this is amortized O(1) per char
+// a line that doesn't own str yet gets its own copy here, with the gap at the end
+static void line_grow(struct LINE *obj, int extra){
+	if (obj->len + extra <= obj->cap) return;
+
+	int cap = obj->cap > 0 ? obj->cap * 2 : SLAB_MIN; // always a power of two
+	while (cap < obj->len + extra) cap *= 2;
+	int tail = obj->len - obj->gap;
+
+	if (obj->cap > SLAB_MAX){ // already malloc'd, realloc can often grow in place
+		stat_count(ST_ALLOC);
+		char *str = (char *) realloc(obj->str, cap);
+		if (str == NULL) die("Failed at line_grow()");
+		memmove(str + cap - tail, str + obj->cap - tail, tail); // tail stays at the very end
+		obj->str = str;
+	}
+	else{
+		char *str = str_alloc(cap);
+		if (obj->cap == 0){
+			if (obj->len > 0) memcpy(str, obj->str, obj->len);
+			obj->gap = obj->len;
+		}
+		else{
+			memcpy(str, obj->str, obj->gap);
+			memcpy(str + cap - tail, line_tail(obj), tail);
+			str_free(obj->str, obj->cap);
+		}
+		obj->str = str;
+	}
+	obj->cap = cap;
+}
+
+// slide the gap so it starts at pos, only the chars between the old and new spot move
+static void line_move_gap(struct LINE *obj, int pos){
+	int gap_len = obj->cap - obj->len;
+	if (pos < obj->gap)
+		memmove(obj->str + pos + gap_len, obj->str + pos, obj->gap - pos);
+	else if (pos > obj->gap)
+		memmove(obj->str + obj->gap, obj->str + obj->gap + gap_len, pos - obj->gap);
+	obj->gap = pos;
 }
 
-// delete columns --- which means delete characters from a line
-void del_cols(struct LINE *obj, char c, int pos){
-	if (obj->len <= 0) return;
+/* UTF-8: a column is a code point, one that draws two cells wide (CJK, most emoji) takes two
+ * screen columns and combining marks take none. Almost every line is pure ASCII though, and on
+ * those all of the below is the identity: whether a line is gets found out when the file is cut
+ * into lines, by a SIMD test of the high bit, and stays known with the width until an edit */
+#define WIDTH_MAX 0xFFFF // struct LINE keeps width in 16 bits, wider lines get walked when asked
+#define HIGH_SCAN 65536 // bytes a load looks ahead for the next high byte
 
-	if (pos < 0 || pos > obj->len) return; // if not in limit, do nothing and return
+// text changed: the journal saves it, the width has to be measured again
+static void line_dirty(struct LINE *obj){
+	obj->dirty = 1;
+	obj->measured = 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static const char *high_sse2(const char *s, size_t n){
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16){
+		unsigned mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+		if (mask != 0) return s + i + __builtin_ctz(mask);
+	}
+	for (; i < n; i++) if ((unsigned char) s[i] >= 0x80) return s + i;
+	return NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *high_avx2(const char *s, size_t n){
+	size_t i = 0;
+	for (; i + 64 <= n; i += 64){ // two loads or'ed, one test per 64 bytes
+		__m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(s + i + 32));
+		if (_mm256_movemask_epi8(_mm256_or_si256(a, b)) == 0) continue;
+		unsigned mask = _mm256_movemask_epi8(a);
+		if (mask != 0) return s + i + __builtin_ctz(mask);
+		return s + i + 32 + __builtin_ctz((unsigned) _mm256_movemask_epi8(b));
+	}
+	return high_sse2(s + i, n - i);
+}
+#endif
 
-	memmove(obj->str + pos - 1 , obj->str + pos, obj->len - pos);
+static const char *high_scalar(const char *s, size_t n){
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8){
+		unsigned long long w;
+		memcpy(&w, s + i, 8);
+		if (w & 0x8080808080808080ULL) break;
+	}
+	for (; i < n; i++) if ((unsigned char) s[i] >= 0x80) return s + i;
+	return NULL;
+}
 
-	obj->len--;
+static const char *(*high_block)(const char *s, size_t n) = NULL;
 
-	// now shrink the memory :)
-	char *temp = realloc(obj->str, obj->len * sizeof(char));
-	if (temp != NULL) obj->str = temp;
+// first byte >= 0x80 in s[0, n), NULL if it is all ASCII
+static const char *find_high(const char *s, size_t n){
+	if (high_block == NULL){
+		high_block = high_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2")) high_block = high_sse2;
+		if (__builtin_cpu_supports("avx2")) high_block = high_avx2;
+#endif
+	}
+	return high_block(s, n);
 }
 
-/* now I will implement adding rows randomly at any point in the file */
-// add more rows --- which means add more lines to the file
-void add_rows(struct LINE **obj, int line_no){
-	if (buf_line_no < 0) return; // < 0, because you can only add from 0 up
+// a line still in the map learns whether it is ASCII from *clean: the map has no high byte from
+// the line start up to *clean, and *clean is one unless the scan hasn't got further. Lines come in
+// file order so the scan only moves forward, HIGH_SCAN at a time so the first screen never waits
+// for the whole file
+static void map_line_measure(struct LINE *line, const char **clean, const char *end){
+	const char *e = line->str + line->len;
+	if (*clean < line->str) *clean = line->str;
+	while (*clean < e && (unsigned char) **clean < 0x80){
+		size_t n = end - *clean < HIGH_SCAN ? end - *clean : HIGH_SCAN;
+		const char *h = find_high(*clean, n);
+		*clean = h != NULL ? h : *clean + n;
+	}
+	line->ascii = *clean >= e;
+	line->measured = line->ascii; // the others get walked the first time they are drawn
+	line->width = line->len < WIDTH_MAX ? line->len : WIDTH_MAX;
+}
 
-	if (line_no < 0 || line_no > buf_line_no) return; // illegal move, you can't go outside like that
+// code point at s[0, n) into *cp, returns how many bytes it took. A byte that doesn't start a
+// well formed sequence (stray, overlong, surrogate, cut short) is a U+FFFD of its own
+static int utf8_decode(const unsigned char *s, int n, int *cp){
+	unsigned c = s[0];
+	if (c < 0x80){
+		*cp = c;
+		return 1;
+	}
+	int k, min;
+	if (c >= 0xC2 && c <= 0xDF){ k = 2; min = 0x80; c &= 0x1F; }
+	else if (c >= 0xE0 && c <= 0xEF){ k = 3; min = 0x800; c &= 0x0F; }
+	else if (c >= 0xF0 && c <= 0xF4){ k = 4; min = 0x10000; c &= 0x07; }
+	else k = 0;
+	if (k == 0 || k > n) goto bad;
+	for (int i = 1; i < k; i++){
+		if ((s[i] & 0xC0) != 0x80) goto bad;
+		c = c << 6 | (s[i] & 0x3F);
+	}
+	if ((int) c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) goto bad;
+	*cp = c;
+	return k;
+bad:
+	*cp = 0xFFFD;
+	return 1;
+}
 
-	struct LINE *newLINE = (struct LINE *) malloc(sizeof(struct LINE)); // malloc memory for new LINE
-	// ignore memory alloc bugs for now ... 
+// cp as UTF-8 into out, returns the length
+static int utf8_encode(unsigned cp, char *out){
+	if (cp < 0x80){
+		out[0] = cp;
+		return 1;
+	}
+	if (cp < 0x800){
+		out[0] = 0xC0 | cp >> 6;
+		out[1] = 0x80 | (cp & 0x3F);
+		return 2;
+	}
+	if (cp < 0x10000){
+		out[0] = 0xE0 | cp >> 12;
+		out[1] = 0x80 | (cp >> 6 & 0x3F);
+		out[2] = 0x80 | (cp & 0x3F);
+		return 3;
+	}
+	out[0] = 0xF0 | cp >> 18;
+	out[1] = 0x80 | (cp >> 12 & 0x3F);
+	out[2] = 0x80 | (cp >> 6 & 0x3F);
+	out[3] = 0x80 | (cp & 0x3F);
+	return 4;
+}
 
-	newLINE->str = (char *) malloc(sizeof(char) * 0); // malloc for str in new LINE
-	newLINE->len = 0; // always start with 0
+struct SPAN{ int from; int to; }; // code points [from, to]
 
-	memmove(obj + line_no + 1, obj + line_no, line_no - line_no); // move by certain line_no to add char
+// marks that sit on the char before them: combining, joiners, variation selectors, skin tones
+static const struct SPAN zero_width[] = {
+	{0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2},
+	{0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A}, {0x064B, 0x065F}, {0x0670, 0x0670},
+	{0x06D6, 0x06DC}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711},
+	{0x0730, 0x074A}, {0x07A6, 0x07B0}, {0x0900, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C},
+	{0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981},
+	{0x09BC, 0x09BC}, {0x09C1, 0x09C4}, {0x09CD, 0x09CD}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A},
+	{0x0E47, 0x0E4E}, {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECD}, {0x1160, 0x11FF},
+	{0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064},
+	{0x20D0, 0x20F0}, {0x302A, 0x302D}, {0x3099, 0x309A}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F},
+	{0xFEFF, 0xFEFF}, {0x1F3FB, 0x1F3FF}, {0xE0001, 0xE0001}, {0xE0020, 0xE007F}, {0xE0100, 0xE01EF}
+};
 
-	obj[line_no] = newLINE;
+// East Asian wide and full width, and the emoji that terminals draw two cells wide
+static const struct SPAN wide[] = {
+	{0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+	{0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+	{0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+	{0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+	{0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+	{0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+	{0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+	{0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+	{0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F},
+	{0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF},
+	{0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251},
+	{0x1F300, 0x1F3FA}, {0x1F400, 0x1F64F}, {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF},
+	{0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}
+};
 
-	buf_line_no++;
+static int in_spans(int cp, const struct SPAN *span, int n){
+	int lo = 0, hi = n - 1;
+	while (lo <= hi){
+		int mid = (lo + hi) / 2;
+		if (cp < span[mid].from) hi = mid - 1;
+		else if (cp > span[mid].to) lo = mid + 1;
+		else return 1;
+	}
+	return 0;
 }
 
-// delete rows --- which means delete lines from the file
-void del_rows(struct LINE **obj, int line_no){
-	if (buf_line_no <= 0) return;
+// cells cp takes on screen: 0, 1 or 2. Control chars are 1, they draw as '?'
+static int cp_width(int cp){
+	if (cp < 0x300) return 1; // ASCII and Latin-1, nothing to look up
+	if (in_spans(cp, zero_width, sizeof(zero_width) / sizeof(zero_width[0]))) return 0;
+	if (in_spans(cp, wide, sizeof(wide) / sizeof(wide[0]))) return 2;
+	return 1;
+}
 
-	if (line_no < 0 || line_no > buf_line_no) return; // illegal move, you can't go outside like that
+static unsigned char line_byte(struct LINE *obj, int i){
+	return i < obj->gap ? obj->str[i] : line_tail(obj)[i - obj->gap];
+}
 
-	free(obj[line_no]->str); // first free the str in the obj
-	free(obj[line_no]); // then the obj
+// code point starting at byte i of the line into *cp, returns its length
+static int line_cp(struct LINE *obj, int i, int *cp){
+	int n = obj->len - i < 4 ? obj->len - i : 4;
+	if (i + n <= obj->gap) return utf8_decode((unsigned char *) obj->str + i, n, cp);
+	if (i >= obj->gap) return utf8_decode((unsigned char *) line_tail(obj) + (i - obj->gap), n, cp);
+	unsigned char b[4]; // the gap cuts through it
+	line_copy(obj, i, n, (char *) b);
+	return utf8_decode(b, n, cp);
+}
 
-	memmove(obj + line_no - 1 , obj + line_no, buf_line_no - line_no);
+// ascii and width right again, one walk over the line and only after it changed
+static void line_measure(struct LINE *obj){
+	if (obj->measured) return;
+	obj->ascii = find_high(obj->str, obj->gap) == NULL && find_high(line_tail(obj), obj->len - obj->gap) == NULL;
+	int x = obj->len;
+	if (!obj->ascii){
+		x = 0;
+		for (int i = 0, cp; i < obj->len; x += cp_width(cp)) i += line_cp(obj, i, &cp);
+	}
+	obj->width = x < WIDTH_MAX ? x : WIDTH_MAX;
+	obj->measured = 1;
+}
 
-	buf_line_no--;
+// screen column of byte col, counted from the start of the line
+static int col_to_x(struct LINE *obj, int col){
+	line_measure(obj);
+	if (obj->ascii) return col;
+	if (col >= obj->len && obj->width < WIDTH_MAX) return obj->width;
+	int x = 0;
+	for (int i = 0, cp; i < col && i < obj->len; x += cp_width(cp)) i += line_cp(obj, i, &cp);
+	return x;
+}
 
-	// now shrink the memory :)	
-	struct LINE **temp = realloc(obj, buf_line_no * sizeof(struct LINE*));
-	if (temp != NULL) obj = temp;
+// byte col of the char drawn at screen column x, the end of the line if it is shorter
+static int x_to_col(struct LINE *obj, int x){
+	line_measure(obj);
+	if (obj->ascii) return x < obj->len ? x : obj->len;
+	int i = 0, w = 0;
+	while (i < obj->len){
+		int cp;
+		int k = line_cp(obj, i, &cp);
+		int cw = cp_width(cp);
+		if (cw > 0 && w + cw > x) break; // marks after the char before stay with it
+		w += cw;
+		i += k;
+	}
+	return i;
 }
-/*-------------------------------------------------------------------------------------------------*/
 
-/*-------------------------------| NON CANONICAL MODE START & END |--------------------------------*/
-/* put terminal into a raw mode */
-int tty_raw(int fd){
-	int err;
-    struct termios  buf;
-    if (ttystate != RESET) {
-        errno = EINVAL;
-        return -1;
-    }
-    if (tcgetattr(fd, &buf) < 0)
-        return -1;
-	save_termios = buf; // structure copy  
-	// off: echo, canonical, extended input processing, signal chars
-    buf.c_lflag &=  ~(ECHO | ICANON | IEXTEN | ISIG); 
-	// off: SIGINT, CRNL, input parity checck, outputflow ctrl
-    buf.c_iflag &=  ~(BRKINT | INPCK | ISTRIP | IXON);
-    
-	buf.c_cflag &=  ~(CSIZE | PARENB); // clear size bits, parity checking off
-    
-    buf.c_cflag |= CS8; // set 8 bits/char
-    
-	buf.c_oflag &=  ~(OPOST); // output processing off
-	
-	buf.c_cc[VMIN] = 1; // 1 byte at a time, no timer
-	buf.c_cc[VTIME] = 0;
+// start of the code point that ends at col
+static int cp_before(struct LINE *obj, int col){
+	if (col <= 0) return 0;
+	int i = col - 1;
+	while (i > 0 && i > col - 4 && (line_byte(obj, i) & 0xC0) == 0x80) i--;
+	int cp;
+	if (i + line_cp(obj, i, &cp) == col) return i;
+	return col - 1; // col - 1 is a stray byte
+}
 
-	if (tcsetattr(fd, TCSAFLUSH, &buf) < 0) return -1; // vertify change
+// col itself if a code point starts there, else the start of the one it is inside
+static int col_snap(struct LINE *obj, int col){
+	if (col >= obj->len) return obj->len;
+	int i = col;
+	while (i > 0 && i > col - 3 && (line_byte(obj, i) & 0xC0) == 0x80) i--;
+	if ((line_byte(obj, i) & 0xC0) == 0x80) return col; // nothing before reaches this far
+	while (i < col){ // a byte that isn't a continuation always starts a code point
+		int cp;
+		int k = line_cp(obj, i, &cp);
+		if (i + k > col) return i;
+		i += k;
+	}
+	return col;
+}
 
-	if (tcgetattr(fd, &buf) < 0) {
-		err = errno;
-		tcsetattr(fd, TCSAFLUSH, &save_termios);
-		errno = err;
-		return -1;
+// the cursor steps over a char with the marks on it and whatever a zero width joiner glues to it
+static int col_next(struct LINE *obj, int col){
+	if (col >= obj->len) return obj->len;
+	int cp, next;
+	col += line_cp(obj, col, &cp);
+	while (col < obj->len){
+		int k = line_cp(obj, col, &next);
+		if (cp_width(next) > 0 && cp != 0x200D) break;
+		cp = next;
+		col += k;
 	}
+	return col;
+}
 
-	// massive error checking to see if everything is applied
-	if ((buf.c_lflag & (ECHO | ICANON | IEXTEN | ISIG)) ||
-	(buf.c_iflag & (BRKINT | INPCK | ISTRIP | IXON)) ||
-	(buf.c_cflag & (CSIZE | PARENB | CS8)) != CS8 ||
-	(buf.c_oflag & OPOST) || buf.c_cc[VMIN] != 1 ||
-	buf.c_cc[VTIME] != 0) {
-		tcsetattr(fd, TCSAFLUSH, &save_termios);
-		errno = EINVAL;
-		return -1;
+static int col_prev(struct LINE *obj, int col){
+	while (col > 0){
+		int cp;
+		col = cp_before(obj, col);
+		line_cp(obj, col, &cp);
+		if (cp_width(cp) == 0) continue; // a mark, the char is before it
+		if (col > 0){
+			line_cp(obj, cp_before(obj, col), &cp);
+			if (cp == 0x200D) continue; // joined to the one before
+		}
+		break;
 	}
-	ttystate = RAW;
-	ttysavefd = fd;
-	return 0;
+	return col;
 }
 
-/* restore terminal’s mode */
-int tty_reset(int fd){
-	if (ttystate == RESET) return 0;
-	if (tcsetattr(fd, TCSAFLUSH, &save_termios) < 0) return -1;
-	ttystate = RESET;
-	return 0;
+/* line tree, lookup/insert/delete of a row are O(log n), nothing shifts the whole file around */
+#define NODE_FILL (NODE_MAX * 3 / 4) // how full a freshly built node is, leaves room for edits
+
+static struct NODE *node_new(int leaf){
+	struct NODE *obj = (struct NODE *) slab_alloc(SLAB_NODE, sizeof(struct NODE));
+	memset(obj, 0, offsetof(struct NODE, kids)); // the slots get written before they are read
+	obj->leaf = leaf;
+	return obj;
 }
 
-/* signal catch error for main */
-void sig_catch(int signo){
-	printf("signal caught\n");
-	tty_reset(STDIN_FILENO);
-	exit(0);
+// leaf holding row, *off is set to where row sits inside it
+static struct NODE *leaf_at(struct NODE *obj, int row, int *off){
+	while (!obj->leaf){
+		int i = 0;
+		while (i < obj->n - 1 && row >= obj->counts[i]) row -= obj->counts[i++];
+		obj = obj->kids[i];
+	}
+	*off = row;
+	return obj;
 }
-/*-------------------------------------------------------------------------------------------------*/
 
-/*-------------------------------| DISPAY ON TERMINAL - finer changes|-----------------------------*/
-/* Do what it meant, clear everything */
-void clear_screen(){
-	printf("\e[1;1H\e[2J");
+// the LINE at row, 0 <= row < buf_line_no. It lives inside a leaf, so the pointer is only good
+// until the next add_rows()/del_rows()
+struct LINE *line_at(struct NODE *obj, int row){
+	int off;
+	obj = leaf_at(obj, row, &off);
+	return &obj->lines[off];
 }
 
-// (1)
-void clear_line(){
-	printf("\33[2K"); // clear whole line where cursor is on
+// memmove n slots from src at si to dst at di: lines for a leaf, kids with their counts otherwise
+static void node_copy(struct NODE *dst, int di, struct NODE *src, int si, int n){
+	if (src->leaf){
+		memmove(dst->lines + di, src->lines + si, n * sizeof(struct LINE));
+		return;
+	}
+	memmove(dst->kids + di, src->kids + si, n * sizeof(struct NODE *));
+	memmove(dst->counts + di, src->counts + si, n * sizeof(int));
 }
 
-// (2)
-void print_new_line(struct LINE *obj){
-	printf("\033[0G"); // move cursor back to column 0
-	for (int i = 0; i < obj->len; i++){
-		putchar(obj->str[i]);
+// move the upper half of a full node into a new right sibling and return it
+static struct NODE *node_split(struct NODE *obj){
+	struct NODE *right = node_new(obj->leaf);
+	int half = obj->n / 2;
+
+	right->n = obj->n - half;
+	node_copy(right, 0, obj, half, right->n);
+	obj->n = half;
+
+	if (obj->leaf){
+		right->count = right->n;
+		right->next = obj->next; // chain it in right after obj
+		right->prev = obj;
+		if (obj->next != NULL) obj->next->prev = right;
+		obj->next = right;
 	}
+	else{
+		for (int i = 0; i < right->n; i++) right->count += right->counts[i];
+	}
+	obj->count -= right->count;
+	return right;
 }
 
-// (3) Move the cursor around -- generalized function to be used anywhere
-void move_cursor(int row, int col){
-	printf("\033[%d;%dH", row + 1, col + 1);
-	fflush(stdout);
+// append b to a, b is the node right after a and gets freed
+static void node_merge(struct NODE *a, struct NODE *b){
+	node_copy(a, a->n, b, 0, b->n);
+	a->n += b->n;
+	a->count += b->count;
+	if (a->leaf){
+		a->next = b->next;
+		if (b->next != NULL) b->next->prev = a;
+	}
+	slab_release(SLAB_NODE, b);
 }
 
-// (1)(2)(3) will be used together to make changes the screen line by line, work on each line first, row comes later
-void add_char_update_screen_buffer(char c, int row, int col){
-	add_cols(buffer[row], c, col); // do internal update to buffer
-	clear_line(); // clear the line the cursor is on
-	print_new_line(buffer[row]); // print the new updated line
-	move_cursor(row, ++CUTE.col); // as we are adding, cursor will move forward with the character
-	fflush(stdout);
+// put a copy of line at row below obj, returns the new right sibling when obj had to split
+static struct NODE *node_insert(struct NODE *obj, int row, struct LINE *line){
+	obj->count++;
+	if (obj->leaf){
+		node_copy(obj, row + 1, obj, row, obj->n - row);
+		obj->lines[row] = *line;
+		obj->n++;
+	}
+	else{
+		int i = 0; // row == count of a kid means append to it
+		while (i < obj->n - 1 && row > obj->counts[i]) row -= obj->counts[i++];
+		struct NODE *right = node_insert(obj->kids[i], row, line);
+		obj->counts[i] = obj->kids[i]->count;
+		if (right != NULL){
+			node_copy(obj, i + 2, obj, i + 1, obj->n - i - 1);
+			obj->kids[i + 1] = right;
+			obj->counts[i + 1] = right->count;
+			obj->n++;
+		}
+	}
+	return obj->n == NODE_MAX ? node_split(obj) : NULL; // keep a free slot for the next insert
 }
-// reverse of add_char_update ...
-void del_char_update_screen_buffer(char c, int row, int col){
-	del_cols(buffer[row], c, col); // do internal update to buffer
-	clear_line(); // clear the line the cursor is on
-	print_new_line(buffer[row]); // print the new updated line
-	move_cursor(row, --CUTE.col); // as we are deletingg, cursor will move backward with the character
-	fflush(stdout);
+
+// take the line at row out from below obj, copying it to *line
+static void node_remove(struct NODE *obj, int row, struct LINE *line){
+	obj->count--;
+	if (obj->leaf){
+		*line = obj->lines[row];
+		node_copy(obj, row, obj, row + 1, obj->n - row - 1);
+		obj->n--;
+		return;
+	}
+
+	int i = 0;
+	while (i < obj->n - 1 && row >= obj->counts[i]) row -= obj->counts[i++];
+	node_remove(obj->kids[i], row, line);
+	obj->counts[i]--;
+
+	struct NODE *kid = obj->kids[i];
+	if (kid->n == 0){ // empty, drop it
+		if (kid->leaf){
+			if (kid->prev != NULL) kid->prev->next = kid->next;
+			if (kid->next != NULL) kid->next->prev = kid->prev;
+		}
+		slab_release(SLAB_NODE, kid);
+		node_copy(obj, i, obj, i + 1, obj->n - i - 1);
+		obj->n--;
+	}
+	else if (kid->n < NODE_MAX / 4 && obj->n > 1){ // sparse, fold it into a neighbour if it fits
+		int a = i + 1 < obj->n ? i : i - 1;
+		if (obj->kids[a]->n + obj->kids[a + 1]->n < NODE_MAX){
+			node_merge(obj->kids[a], obj->kids[a + 1]);
+			obj->counts[a] = obj->kids[a]->count;
+			node_copy(obj, a + 1, obj, a + 2, obj->n - a - 2);
+			obj->n--;
+		}
+	}
 }
 
-// ---- REWORK ADD and DEL ROWS to account for new insights. add & del will rather create a 
-// new line with \n string or what ever comes after cols cursor, while doing that, it leaves a \n on its path
-void add_line_update_screen_buffer(int line_no){
+// build the upper levels over count chained leaves in one go, level is malloc'd and gets freed
+static struct NODE *tree_build(struct NODE **level, int count){
+	while (count > 1){ // group each level under new parents until one root is left
+		int parents = (count + NODE_FILL - 1) / NODE_FILL;
+		for (int i = 0; i < parents; i++){
+			struct NODE *obj = node_new(0);
+			for (int j = i * NODE_FILL; j < count && obj->n < NODE_FILL; j++){
+				obj->counts[obj->n] = level[j]->count;
+				obj->kids[obj->n++] = level[j];
+				obj->count += level[j]->count;
+			}
+			level[i] = obj;
+		}
+		count = parents;
+	}
 
+	struct NODE *root = level[0];
+	free(level);
+	return root;
 }
-/*-------------------------------------------------------------------------------------------------*/
 
-/* process user input from STDIN */
-void handle_input(char c){
-	switch(c){
-		case '\033':
-			{ // begin of block
-				char seq[3];
-				if (read(STDIN_FILENO, &seq[0], 1) == -1) break; 
-				if (read(STDIN_FILENO, &seq[1], 1) == -1) break;
-				if (seq[0] == '['){
-					switch (seq[1]) {
-						case 'A': // Up arrow
-							if (CUTE.row > 0) CUTE.row--;
-							if (CUTE.col > buffer[CUTE.row]->len) // to not exceed limit travel
-								CUTE.col = buffer[CUTE.row]->len;
-							break;
-						case 'B': // Down arrow
-							if (CUTE.row < buf_line_no - 1) CUTE.row++; // Assuming a 24-row terminal for now ...
-							if (CUTE.col > buffer[CUTE.row]->len) // to not exceed limit travel, like VIM
-								CUTE.col = buffer[CUTE.row]->len;
-							break;
-						case 'C': // Right arrow
-							if (CUTE.col >= buffer[CUTE.row]->len) CUTE.col = buffer[CUTE.row]->len; // doesn't account when line empty
-							else CUTE.col++;
-							break;
-						case 'D':
-							if (CUTE.col > 0) CUTE.col--;
-							break;
-						default:
-							break;
-					}
-					move_cursor(CUTE.row, CUTE.col); // Move cursor to the new position
-				}
-			} // end of block
-			break;
-		case 127: // DELETE or BACKSPACE
-		case 8: // this the same as BACKSPACE
-			del_char_update_screen_buffer(c, CUTE.row, CUTE.col);
-			break;
-		case '\r': // ENTER
-		case '\n': // ENTER
-		default: // Regular characters
-			add_char_update_screen_buffer(c, CUTE.row, CUTE.col);
+// leaf goes in after the last leaf under obj. Returns NULL if it fit, else a new node to go on
+// obj's right: the right edge of the tree grows like tree_build() fills, up to NODE_FILL
+static struct NODE *node_append(struct NODE *obj, struct NODE *leaf){
+	struct NODE *last = obj->kids[obj->n - 1];
+	struct NODE *kid = leaf; // what goes next to last
+	if (!last->leaf){
+		kid = node_append(last, leaf);
+		if (kid == NULL){ // it fit under last
+			obj->counts[obj->n - 1] += leaf->count;
+			obj->count += leaf->count;
+			return NULL;
+		}
+	}
+	if (obj->n < NODE_FILL){
+		obj->kids[obj->n] = kid;
+		obj->counts[obj->n++] = kid->count;
+		obj->count += kid->count;
+		return NULL;
+	}
+	struct NODE *right = node_new(0);
+	right->kids[0] = kid;
+	right->counts[0] = kid->count;
+	right->n = 1;
+	right->count = kid->count;
+	return right;
+}
+
+// a filled leaf after the last line of the tree, for the loader
+static void tree_append_leaf(struct NODE **obj, struct NODE *leaf){
+	struct NODE *last = *obj;
+	while (!last->leaf) last = last->kids[last->n - 1];
+	last->next = leaf;
+	leaf->prev = last;
+	leaf->next = NULL;
+
+	struct NODE *right = (*obj)->leaf ? leaf : node_append(*obj, leaf);
+	if (right != NULL){ // tree grows one level
+		struct NODE *root = node_new(0);
+		root->kids[0] = *obj;
+		root->kids[1] = right;
+		root->counts[0] = (*obj)->count;
+		root->counts[1] = right->count;
+		root->n = 2;
+		root->count = (*obj)->count + right->count;
+		*obj = root;
+	}
+}
+
+// is this line still the untouched slice of file_map it was loaded as?
+static int line_in_map(struct LINE *obj){
+	return obj->cap == 0 && doc->file_map != NULL && obj->str >= doc->file_map && obj->str <= doc->file_map + doc->file_map_size;
+}
+
+// map the file and cut it into lines in a single memchr() pass, memchr() is vectorized in libc
+// so the scan runs close to memory speed. LINEs go straight into the leaves of the tree
+// a tree built bottom up: lines fill leaves left to right, tree_build() stacks parents on them
+struct BUILD{
+	struct NODE **leaves;
+	int n;
+	int cap;
+	int rows;
+};
+
+// next empty LINE at the end, a new leaf once the last one holds NODE_FILL
+static struct LINE *build_line(struct BUILD *b){
+	struct NODE *leaf = b->n > 0 ? b->leaves[b->n - 1] : NULL;
+	if (leaf == NULL || leaf->n == NODE_FILL){ // start the next leaf
+		if (b->n == b->cap){
+			b->cap = b->cap ? b->cap * 2 : 64;
+			struct NODE **temp = (struct NODE **) realloc(b->leaves, b->cap * sizeof(struct NODE *));
+			if (temp == NULL) die("Initial allocation failed");
+			b->leaves = temp;
+		}
+		struct NODE *next = node_new(1);
+		if (leaf != NULL){
+			leaf->next = next;
+			next->prev = leaf;
+		}
+		leaf = b->leaves[b->n++] = next;
+	}
+	struct LINE *line = &leaf->lines[leaf->n++];
+	leaf->count++;
+	b->rows++;
+	memset(line, 0, sizeof(struct LINE));
+	return line;
+}
+
+// map the file and make lines of it, up to max_rows of them. Returns where it stopped, NULL at the end.
+// If the file can't be mapped doc->buffer stays NULL and the status line says why
+static char *file_map_scan(FILE *fp, int max_rows){
+	struct stat st;
+
+	doc->file_map = NULL;
+	doc->file_map_size = 0;
+	if (fp != NULL){
+		if (fstat(fileno(fp), &st) < 0){
+			snprintf(status_line, sizeof(status_line), "fstat error: %s", strerror(errno));
+			return NULL;
+		}
+		doc->file_map_size = st.st_size;
+	}
+	if (doc->file_map_size > 0){
+		doc->file_map = (char *) mmap(NULL, doc->file_map_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+		if (doc->file_map == MAP_FAILED){
+			snprintf(status_line, sizeof(status_line), "mmap error: %s", strerror(errno));
+			doc->file_map = NULL;
+			doc->file_map_size = 0;
+			return NULL;
+		}
+		madvise(doc->file_map, doc->file_map_size, MADV_SEQUENTIAL); // only for the scan below
+	}
+
+	struct BUILD b = {NULL, 0, 0, 0};
+	char *s = doc->file_map;
+	char *end = doc->file_map + doc->file_map_size;
+	const char *clean = s;
+	// the last line has no '\n' at the end, or the file is empty: it is still a line
+	while ((s < end || b.rows == 0) && b.rows < max_rows){
+		char *nl = s < end ? memchr(s, '\n', end - s) : NULL;
+		if (nl == NULL) nl = end;
+
+		struct LINE *line = build_line(&b);
+		line->len = nl - s;
+		line->gap = line->len;
+		line->str = s;
+		map_line_measure(line, &clean, end);
+
+		if (nl == end){
+			s = end;
 			break;
-	} // end of switch
+		}
+		s = nl + 1;
+	}
+	if (doc->file_map != NULL && s == end) madvise(doc->file_map, doc->file_map_size, MADV_NORMAL);
+
+	doc->buffer = tree_build(b.leaves, b.n);
+	doc->file_rows = b.rows;
+	doc->buf_line_no = doc->file_rows;
+	return s < end ? s : NULL;
 }
 
-/* get current file size -- IGNORE THIS FOR NOW */
-int get_file_size(char* file_name){
-	FILE* fp = fopen(file_name, "rb");
-	
-	if (fp == NULL) return 0; // there is nothing so ...
-	
-	fseek(fp, 0L, SEEK_END); // go to the end
-	
-	int res = ftell(fp); // get file size
-	
-	fclose(fp);
-	
-	return res;
+void file_to_buffer(FILE *fp){
+	double start = now_ms();
+	file_map_scan(fp, INT_MAX);
+	load_ms = now_ms() - start;
 }
 
-/* Main Method */
-int main(int argc, char *argv[]){
-	if (argc <= 1) die("Oops we haven't implemented that yet"); // I will implement this logic later
+// the first LOAD_FIRST lines now, the rest from the loader thread while the editor already runs
+void file_to_buffer_bg(FILE *fp){
+	double start = now_ms();
+	char *rest = file_map_scan(fp, LOAD_FIRST);
+	load_ms = first_ms = now_ms() - start;
+	if (rest != NULL) load_start(rest);
+}
 
-	// catch error signal
-	if (signal(SIGINT, sig_catch) == SIG_ERR) die("signal(SIGINT) error"); 
-	if (signal(SIGQUIT, sig_catch) == SIG_ERR) die("signal(SIGQUIT) error");
-	if (signal(SIGTERM, sig_catch) == SIG_ERR) die("signal(SIGTERM) error");
+#define SAVE_IOV 1024 // slices per writev(), IOV_MAX is at least this on Linux and macOS
 
-	int file_size = get_file_size(argv[1]);
-	file_write_to = fopen(argv[1], "rb"); // in the mean time I will do this
-	file_to_buffer(file_write_to, file_size); // now read from file to buffer
-	fclose(file_write_to); // now we close the file, don't need it for now
+static struct iovec save_iov[SAVE_IOV];
+static int save_niov = 0;
+static int save_fd = -1;
+static char *save_tmp = NULL; // temp file name, unlinked if the save dies half way
+static int save_in_place = 0; // no temp file: slices are copied into save_copy, not written
+static char *save_copy = NULL; // the whole file, the map it comes from is what gets overwritten
+static size_t save_copy_len = 0;
+static size_t save_copy_cap = 0;
 
-	clear_screen(); 
-	print_buffer(buffer, file_rows); // let see if it print
-	move_cursor(CUTE.row, CUTE.col); // move to OG position of 0 0 in the beginning
+// a failed save leaves the old file alone and no temp file behind
+static char save_error[512]; // why the last buffer_to_file() failed, empty if it didn't
 
-	// raw mode
-	if (tty_raw(STDIN_FILENO) < 0) die("tty_raw error");
+// give up on the save: what and errno go to save_error, the old file and the swap file stay as
+// they are, the temp file goes. Returns -1 for buffer_to_file() to pass on
+static int save_abort(const char *what){
+	if (save_error[0] == '\0') snprintf(save_error, sizeof(save_error), "%s: %s", what, strerror(errno));
+	if (save_fd >= 0) close(save_fd);
+	save_fd = -1;
+	if (save_tmp != NULL) unlink(save_tmp);
+	save_tmp = NULL;
+	save_niov = 0;
+	save_in_place = 0;
+	free(save_copy);
+	save_copy = NULL;
+	save_copy_cap = save_copy_len = 0;
+	return -1;
+}
 
-	// now write to buffer and print to terminal screen
-	int i;
-	char c;
-	while ((i = read(STDIN_FILENO, &c, 1)) == 1){
-		if ((c &= 255) == 021) break; /* 021 = CTRL-Q */
-		else{
-			handle_input(c);
+// write out the queued slices, writev() may stop short anywhere, even inside a slice
+static void save_flush(){
+	if (save_error[0] != '\0') return; // failed already, buffer_to_file() finds out after the walk
+	struct iovec *iov = save_iov;
+	int left = save_niov;
+	for (; save_in_place && left > 0; iov++, left--){ // in place: into save_copy, not out
+		size_t need = save_copy_len + iov->iov_len;
+		if (need > save_copy_cap){
+			while (need > save_copy_cap) save_copy_cap = save_copy_cap ? save_copy_cap * 2 : 1 << 16;
+			char *temp = (char *) realloc(save_copy, save_copy_cap);
+			if (temp == NULL){
+				save_abort("Failed at save_flush()");
+				return;
+			}
+			save_copy = temp;
+		}
+		memcpy(save_copy + save_copy_len, iov->iov_base, iov->iov_len);
+		save_copy_len = need;
+	}
+	while (left > 0){
+		ssize_t n = writev(save_fd, iov, left);
+		if (n < 0){
+			if (errno == EINTR) continue;
+			save_abort("Error writing buffer to file");
+			return;
+		}
+		save_bytes += n;
+		while (left > 0 && (size_t)n >= iov->iov_len){
+			n -= iov->iov_len;
+			iov++;
+			left--;
+		}
+		if (left > 0){
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
 		}
 	}
-	printf("\n"); // simply for visual, might not even need this
+	save_niov = 0;
+}
 
-	buffer_to_file(buffer, argv[1]); // now update the file
+// queue a slice, nothing is copied: the bytes stay where they are in file_map or the line
+static void save_put(const char *str, size_t len){
+	if (len == 0) return;
+	if (save_niov == SAVE_IOV) save_flush();
+	save_iov[save_niov].iov_base = (void *)str;
+	save_iov[save_niov].iov_len = len;
+	save_niov++;
+}
 
-	free_buffer(&buffer); // free everything
-	
-	// reset to OG state and error checking
-	if (tty_reset(STDIN_FILENO) < 0) die("tty_reset error"); // reset to og setting		
-	if (i <= 0) die("read error");
+// fsync() the directory too, otherwise the rename itself may not survive a crash
+static void save_sync_dir(char *filename){
+	char dir[4096];
+	char *slash = strrchr(filename, '/');
+	if (slash == NULL) strcpy(dir, ".");
+	else if (slash == filename) strcpy(dir, "/");
+	else snprintf(dir, sizeof(dir), "%.*s", (int)(slash - filename), filename);
+	int fd = open(dir, O_RDONLY);
+	if (fd < 0) return; // not fatal, the data itself is already on disk
+	fsync(fd);
+	close(fd);
+}
+
+// write from buffer to file, pieces go straight out: a run of lines still sitting next to each
+// other in file_map is one slice of the map, '\n' included, and slices leave in writev() batches.
+// Because the map is the target file, we write a temp file next to it, fsync() it once and rename()
+// it over, never truncating what we are reading from. A crash leaves the old file or the new one.
+// A symlink is followed, the file it points to gets replaced. A file with hard links, or in a
+// directory we can't make the temp file in, is written in place: all of it is copied out of the
+// map first, then the file is truncated and written, that one isn't crash safe.
+// Returns -1 if it failed, save_error says why
+int buffer_to_file(struct NODE *obj, char *filename){
+	char tmp_name[4096], real[PATH_MAX];
+	struct stat st;
+	double start = now_ms();
+
+	load_wait(INT_MAX); // all of it, or the rest of the file is lost
+	save_error[0] = '\0';
+	if (realpath(filename, real) != NULL) filename = real;
+	int exists = stat(filename, &st) == 0;
+	save_fd = -1;
+	if (!exists || st.st_nlink == 1){ // a rename would leave the other names on the old file
+		if (snprintf(tmp_name, sizeof(tmp_name), "%s.grid-XXXXXX", filename) >= sizeof(tmp_name)){
+			errno = ENAMETOOLONG;
+			return save_abort("Error creating temp file");
+		}
+		save_fd = mkstemp(tmp_name);
+	}
+	save_in_place = save_fd < 0;
+	save_copy_len = 0;
+	if (!save_in_place){
+		save_tmp = tmp_name;
+		if (exists){ // keep the file's owner and permissions, chown first, it may clear set-id bits
+			if (fchown(save_fd, st.st_uid, st.st_gid) < 0){} // only root can give a file away
+			fchmod(save_fd, st.st_mode & 07777);
+		}
+	}
+	save_bytes = 0;
+
+	char *map_end = doc->file_map + doc->file_map_size;
+	int off;
+	struct NODE *leaf = leaf_at(obj, 0, &off); // walk the leaves in order, off is the line inside leaf
+	while (leaf != NULL){
+		if (off == leaf->n){
+			leaf = leaf->next;
+			off = 0;
+			continue;
+		}
+		struct LINE *line = &leaf->lines[off++];
+		if (line_in_map(line)){
+			char *run_end = line->str + line->len;
+			while (leaf != NULL){ // extend the run while the next line follows the '\n' of this one
+				if (off == leaf->n){
+					leaf = leaf->next;
+					off = 0;
+					continue;
+				}
+				struct LINE *next = &leaf->lines[off];
+				if (!line_in_map(next) || next->str != run_end + 1 || *run_end != '\n') break;
+				run_end = next->str + next->len;
+				off++;
+			}
+			int has_nl = run_end < map_end && *run_end == '\n'; // no '\n' after a split line, or at EOF
+			save_put(line->str, run_end - line->str + has_nl);
+			if (!has_nl) save_put("\n", 1);
+			continue;
+		}
+
+		save_put(line->str, line->gap); // edited line, both sides of the gap
+		save_put(line_tail(line), line->len - line->gap);
+		save_put("\n", 1);
+	}
+	save_flush();
+	if (save_error[0] != '\0') return -1;
+
+	int done;
+	if (save_in_place){ // nothing reads the map any more, the file can go
+		save_in_place = 0;
+		save_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (save_fd < 0) return save_abort("Error opening file for writing");
+		save_put(save_copy, save_copy_len);
+		save_flush();
+		if (save_error[0] != '\0') return -1;
+		if (fsync(save_fd) < 0) return save_abort("Error syncing file");
+		done = close(save_fd);
+		save_fd = -1;
+		if (done < 0) return save_abort("Error writing buffer to file");
+		free(save_copy);
+		save_copy = NULL;
+		save_copy_cap = save_copy_len = 0;
+	}
+	else{
+		if (fsync(save_fd) < 0) return save_abort("Error syncing temp file");
+		done = close(save_fd);
+		save_fd = -1;
+		if (done < 0) return save_abort("Error writing buffer to file");
+		if (rename(tmp_name, filename) < 0) return save_abort("Error renaming temp file");
+		save_tmp = NULL;
+		save_sync_dir(filename);
+	}
+	save_ms = now_ms() - start;
+	printf("Completed buffer_to_file: %lld bytes in %.3f ms\n", save_bytes, save_ms);
+	return 0;
+}
+
+// now delete memories used, the arena goes back in one sweep, only big payloads are freed one by one
+// give back the nodes of a tree whose lines are all pieces of file_map, the arena stays
+static void tree_free(struct NODE *obj){
+	if (!obj->leaf) for (int i = 0; i < obj->n; i++) tree_free(obj->kids[i]);
+	slab_release(SLAB_NODE, obj);
+}
+
+// a tree that goes while the others stay: the strs of its lines, then its nodes
+static void tree_drop(struct NODE *obj){
+	int off;
+	for (struct NODE *leaf = leaf_at(obj, 0, &off); leaf != NULL; leaf = leaf->next)
+		for (int i = 0; i < leaf->n; i++) str_free(leaf->lines[i].str, leaf->lines[i].cap);
+	tree_free(obj);
+}
+
+// the big payloads of every document and their maps, then the arena in one go
+void free_buffer(){
+	load_cancel(); // it still reads file_map, and what it made goes in the arena below
+
+	for (struct DOC *d = docs; d != NULL; d = d->next){
+		int off;
+		for (struct NODE *leaf = d->buffer ? leaf_at(d->buffer, 0, &off) : NULL; leaf != NULL && big_strs > 0;
+			leaf = leaf->next){
+			for (int i = 0; i < leaf->n; i++){
+				if (leaf->lines[i].cap > SLAB_MAX) str_free(leaf->lines[i].str, leaf->lines[i].cap);
+			}
+		}
+		d->buffer = NULL;
+		if (d->file_map != NULL) munmap(d->file_map, d->file_map_size);
+		d->file_map = NULL;
+	}
+	arena_free_all(); // every node, every LINE and every small str
+}
+
+// add more columns --- which means add more characters to a line
+// the gap follows the cursor, so typing only moves chars when the cursor jumped
+void add_cols(struct LINE *obj, char c, int pos){
+	if (obj->len < 0) return; 
+
+	if (pos < 0 || pos > obj->len) return; // if not in limit, do nothing and return
+
+	double start = stat_start();
+	line_grow(obj, 1); // no allocator call unless the gap is used up
+	line_move_gap(obj, pos);
+
+	obj->str[obj->gap++] = c;
+
+	obj->len++;
+	line_dirty(obj);
+	stat_stop(ST_ADD_COLS, start);
+}
+
+// delete columns --- which means delete characters from a line, the one right before pos
+// all bytes of it, a code point is never cut in half. Returns how many bytes that was
+int del_cols(struct LINE *obj, char c, int pos){
+	if (obj->len <= 0) return 0;
+
+	if (pos <= 0 || pos > obj->len) return 0; // if not in limit, do nothing and return
+
+	double start = stat_start();
+	int k = pos - cp_before(obj, pos);
+	if (obj->cap == 0) line_grow(obj, 1); // can't touch file_map, get our own copy
+	line_move_gap(obj, pos);
+
+	obj->gap -= k; // char just swallowed by the gap, memory is kept for the next insert
+
+	obj->len -= k;
+	line_dirty(obj);
+	stat_stop(ST_DEL_COLS, start);
+	return k;
+}
+
+/* now I will implement adding rows randomly at any point in the file */
+// add more rows --- which means add more lines to the file, an empty one at line_no
+void add_rows(struct NODE **obj, int line_no){
+	if (doc->buf_line_no < 0) return; // < 0, because you can only add from 0 up
+
+	if (line_no < 0 || line_no > doc->buf_line_no) return; // illegal move, you can't go outside like that
+
+	double start = stat_start();
+	struct LINE newLINE; // copied into its leaf
+
+	memset(&newLINE, 0, sizeof(newLINE));
+	newLINE.str = NULL; // str gets allocated by the first add_cols()
+	newLINE.len = 0; // always start with 0
+	newLINE.cap = 0;
+	newLINE.gap = 0;
+	line_dirty(&newLINE);
+
+	newLINE.hl = 0;
+	hl_rows(line_no, 1);
+	win_rows(line_no, 1);
+
+	struct NODE *right = node_insert(*obj, line_no, &newLINE);
+	if (right != NULL){ // root split, tree grows one level
+		struct NODE *root = node_new(0);
+		root->kids[0] = *obj;
+		root->kids[1] = right;
+		root->counts[0] = (*obj)->count;
+		root->counts[1] = right->count;
+		root->n = 2;
+		root->count = (*obj)->count + right->count;
+		*obj = root;
+	}
+
+	doc->buf_line_no++;
+	stat_stop(ST_ADD_ROWS, start);
+}
+
+// delete rows --- which means delete lines from the file
+void del_rows(struct NODE **obj, int line_no){
+	if (doc->buf_line_no <= 0) return;
+
+	if (line_no < 0 || line_no >= doc->buf_line_no) return; // illegal move, you can't go outside like that
+
+	double start = stat_start();
+	struct LINE line;
+	node_remove(*obj, line_no, &line);
+	hl_rows(line_no, -1);
+	win_rows(line_no, -1);
+	str_free(line.str, line.cap); // the LINE itself was inside its leaf
+
+	if (!(*obj)->leaf && (*obj)->n == 1){ // root with a single kid, tree shrinks one level
+		struct NODE *root = (*obj)->kids[0];
+		slab_release(SLAB_NODE, *obj);
+		*obj = root;
+	}
+
+	doc->buf_line_no--;
+	stat_stop(ST_DEL_ROWS, start);
+}
+
+// cut line row in two at col, the part after col becomes a new line right below
+void split_line(int row, int col){
+	add_rows(&doc->buffer, row + 1); // first, it can move lines between leaves
+	struct LINE *obj = line_at(doc->buffer, row);
+	struct LINE *below = line_at(doc->buffer, row + 1);
+	int n = obj->len - col;
+	line_dirty(obj);
+	line_dirty(below);
+
+	if (obj->cap == 0){ // still a piece of file_map: both halves stay pieces of it, no copy
+		below->str = obj->str + col;
+		below->len = n;
+		below->gap = n;
+		obj->len = col;
+		obj->gap = col;
+		return;
+	}
+
+	line_move_gap(obj, col); // everything after col is now the tail
+	line_grow(below, n);
+	memcpy(below->str, line_tail(obj), n);
+	below->len = n;
+	below->gap = n;
+	obj->len = col; // the gap swallows the old tail
+}
+
+// append line row + 1 to line row and delete it, this is what backspace at col 0 does
+void join_lines(int row){
+	struct LINE *obj = line_at(doc->buffer, row);
+	struct LINE *below = line_at(doc->buffer, row + 1);
+	line_dirty(obj);
+
+	if (below->len > 0){
+		line_grow(obj, below->len);
+		line_move_gap(obj, obj->len);
+		memcpy(obj->str + obj->gap, below->str, below->gap); // both sides of the gap below
+		memcpy(obj->str + obj->gap + below->gap, line_tail(below), below->len - below->gap);
+		obj->gap += below->len;
+		obj->len += below->len;
+	}
+	del_rows(&doc->buffer, row + 1);
+}
+
+// put n bytes into line obj at pos with one gap move
+static void line_insert(struct LINE *obj, int pos, const char *s, int n){
+	if (n == 0) return;
+	line_grow(obj, n);
+	line_move_gap(obj, pos);
+	memcpy(obj->str + obj->gap, s, n);
+	obj->gap += n;
+	obj->len += n;
+	line_dirty(obj);
+}
+
+// insert a whole block of text at row/col in one go, a paste for example: '\n', '\r' or "\r\n"
+// start a new line. The line is split once and every pasted line is filled in whole, so this
+// is O(n + lines log n) instead of a split per line dragging the rest of the line along.
+// *end is where the text stops, which is where the cursor goes
+void insert_text(int row, int col, const char *s, int n, struct CURPOR *end){
+	hl_edit(row);
+	const char *stop = s + n;
+	const char *nl = s;
+	while (nl < stop && *nl != '\n' && *nl != '\r') nl++;
+
+	line_insert(line_at(doc->buffer, row), col, s, nl - s); // up to the first line break, or all of it
+	col += nl - s;
+	if (nl < stop){
+		split_line(row, col); // the rest of the old line waits on the row below
+		while (nl < stop){
+			nl += (nl[0] == '\r' && nl + 1 < stop && nl[1] == '\n') ? 2 : 1;
+			const char *from = nl;
+			while (nl < stop && *nl != '\n' && *nl != '\r') nl++;
+			row++;
+			if (nl < stop) add_rows(&doc->buffer, row); // a full line of its own
+			line_insert(line_at(doc->buffer, row), 0, from, nl - from); // last piece goes before the rest
+			col = nl - from;
+		}
+	}
+	end->row = row;
+	end->col = col;
+}
+
+// the whole line becomes s[0, n), in a str of its own
+void line_set(struct LINE *obj, const char *s, int n){
+	str_free(obj->str, obj->cap);
+	obj->str = NULL;
+	obj->cap = obj->len = obj->gap = 0;
+	line_grow(obj, n);
+	memcpy(obj->str, s, n);
+	obj->len = obj->gap = n;
+	line_dirty(obj);
+}
+
+// take n bytes out going forward from row col, the end of a line counts as one byte and joins
+// the line below on. The other half of insert_text(), journal replay needs both
+void delete_text(int row, int col, int n){
+	hl_edit(row);
+	while (n > 0 && row < doc->buf_line_no){
+		struct LINE *obj = line_at(doc->buffer, row);
+		if (col < obj->len){
+			int k = obj->len - col < n ? obj->len - col : n;
+			if (obj->cap == 0) line_grow(obj, 1); // can't touch file_map, get our own copy
+			line_move_gap(obj, col + k);
+			obj->gap -= k; // all k swallowed by the gap at once
+			obj->len -= k;
+			line_dirty(obj);
+			n -= k;
+		}
+		else if (row + 1 < doc->buf_line_no){
+			join_lines(row);
+			n--;
+		}
+		else break;
+	}
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| NON CANONICAL MODE START & END |--------------------------------*/
+/* put terminal into a raw mode */
+int tty_raw(int fd){
+	int err;
+    struct termios  buf;
+    if (ttystate != RESET) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (tcgetattr(fd, &buf) < 0)
+        return -1;
+	save_termios = buf; // structure copy  
+	// off: echo, canonical, extended input processing, signal chars
+    buf.c_lflag &=  ~(ECHO | ICANON | IEXTEN | ISIG); 
+	// off: SIGINT, CRNL, input parity checck, outputflow ctrl
+    buf.c_iflag &=  ~(BRKINT | INPCK | ISTRIP | IXON);
+    
+	buf.c_cflag &=  ~(CSIZE | PARENB); // clear size bits, parity checking off
+    
+    buf.c_cflag |= CS8; // set 8 bits/char
+    
+	buf.c_oflag &=  ~(OPOST); // output processing off
+	
+	buf.c_cc[VMIN] = 1; // 1 byte at a time, no timer
+	buf.c_cc[VTIME] = 0;
+
+	if (tcsetattr(fd, TCSAFLUSH, &buf) < 0) return -1; // vertify change
+
+	if (tcgetattr(fd, &buf) < 0) {
+		err = errno;
+		tcsetattr(fd, TCSAFLUSH, &save_termios);
+		errno = err;
+		return -1;
+	}
+
+	// massive error checking to see if everything is applied
+	if ((buf.c_lflag & (ECHO | ICANON | IEXTEN | ISIG)) ||
+	(buf.c_iflag & (BRKINT | INPCK | ISTRIP | IXON)) ||
+	(buf.c_cflag & (CSIZE | PARENB | CS8)) != CS8 ||
+	(buf.c_oflag & OPOST) || buf.c_cc[VMIN] != 1 ||
+	buf.c_cc[VTIME] != 0) {
+		tcsetattr(fd, TCSAFLUSH, &save_termios);
+		errno = EINVAL;
+		return -1;
+	}
+	ttystate = RAW;
+	ttysavefd = fd;
+	return 0;
+}
+
+/* restore terminal’s mode */
+int tty_reset(int fd){
+	if (ttystate == RESET) return 0;
+	if (tcsetattr(fd, TCSAFLUSH, &save_termios) < 0) return -1;
+	ttystate = RESET;
+	return 0;
+}
+
+static int sig_pipe[2] = {-1, -1}; // self-pipe: handlers write the signal number, the event loop polls [0]
+
+/* send the signal number down the pipe, whatever it means gets decided in the event loop */
+static void sig_send(int signo){
+	int saved = errno;
+	unsigned char b = signo;
+	if (write(sig_pipe[1], &b, 1) < 0){} // pipe full: a wakeup is already pending
+	errno = saved;
+}
+
+/* SIGINT, SIGQUIT, SIGTERM: the loop stops and the terminal gets restored outside the handler */
+void sig_catch(int signo){
+	sig_send(signo);
+}
+
+/* window size changed, the frames get resized outside the handler */
+void sig_winch(int signo){
+	sig_send(signo);
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| DISPAY ON TERMINAL - finer changes|-----------------------------*/
+/* Do what it meant, clear everything */
+void clear_screen(){
+	printf("\e[1;1H\e[2J");
+}
+
+/* screen model: frame_prev is what the terminal shows, frame_next is drawn from the buffer.
+ * refresh_screen() diffs them row by row and only the changed part of a changed row goes out,
+ * rows or chars that merely moved are shifted on the terminal and the cursor takes the shortest
+ * way. every escape sequence of the frame lands in screen_out and leaves in a single write() */
+struct ABUF{ // append buffer, grows by doubling and is reused from frame to frame
+	char *b;
+	int len;
+	int cap;
+};
+
+enum PEN{ // what color a cell is drawn in, the highlighter picks them
+	PEN_PLAIN,
+	PEN_COMMENT,
+	PEN_STRING,
+	PEN_NUMBER,
+	PEN_KEYWORD,
+	PEN_TYPE,
+	PEN_PREPROC,
+	PEN_KEY, // JSON object keys
+	PEN_ERROR, // log levels
+	PEN_WARN,
+	PEN_INFO,
+	PEN_DEBUG,
+	PEN_TIME
+};
+
+static const char *pen_sgr[] = {"\033[m", "\033[36m", "\033[32m", "\033[31m", "\033[33m", "\033[34m",
+	"\033[35m", "\033[34m", "\033[1;31m", "\033[33m", "\033[32m", "\033[2m", "\033[36m"};
+
+static struct ABUF screen_out = {NULL, 0, 0};
+static long long screen_bytes = 0; // what ab_flush() has written, all frames together
+static long long screen_writes = 0; // and in how many write() calls
+static double screen_write_ms = 0; // how long the last ab_flush() was in write()
+#define CELL_WIDE 0x110000 // right half of a wide char, the terminal draws it with the left half
+#define CELL_MARKS 0x200000 // plus an offset into marks_next: a char with marks on it, as UTF-8
+static unsigned *frame_prev = NULL; // screen_rows * screen_cols code points each, row after row
+static unsigned *frame_next = NULL;
+static unsigned char *pen_prev = NULL; // and the PEN of every cell
+static unsigned char *pen_next = NULL;
+static int screen_rows = 24; // what TIOCGWINSZ says, 24x80 if it can't tell
+static int screen_cols = 80;
+static int frame_valid = 0; // 0 until frame_prev really is on the screen
+#define SKIP_CELLS 6 // unchanged cells in a row that frame_send() moves over instead of repainting
+#define SCROLL_COST 32 // bytes a scroll has to save to pay for its escape sequences
+#define SHIFT_MAX 8 // chars typed or deleted at once that a row is shifted over for
+#define HIDE_BYTES 64 // a frame this small goes out without hiding the cursor first, it can't flicker
+static int out_row = -1; // where the terminal's cursor is, -1 while that isn't known
+static int out_col = -1;
+static unsigned *hash_prev = NULL; // a hash of each row of frame_prev, for frame_scroll()
+static unsigned *hash_next = NULL; // and of frame_next, they swap with the frames
+static int hash_prev_ok = 0; // 0 if hash_prev wasn't worked out for the last frame
+static int *row_len = NULL; // and how wide frame_next's rows are without their blank tails
+static int *cell_at = NULL; // a row's worth: which byte of the line each cell shows
+static char *row_bytes = NULL; // a row's worth of an ASCII line
+static unsigned char *byte_pens = NULL; // pens of the bytes a UTF-8 row shows, can be 4+ per cell
+static int byte_pens_cap = 0;
+static struct ABUF marks_prev = {NULL, 0, 0}; // what CELL_MARKS cells show: a length byte, the bytes
+static struct ABUF marks_next = {NULL, 0, 0};
+int pager = 0; // grid -R: the file is only looked at, through the PAGER section
+int screen_stale = 1; // something changed on screen, the loop redraws once it has run everything
+
+// rows the buffer gets on screen
+static int text_rows(){
+	return status_line[0] && screen_rows > 1 ? screen_rows - 1 : screen_rows;
+}
+
+static void ab_append(struct ABUF *ab, const char *s, int n){
+	if (ab->len + n > ab->cap){
+		int cap = ab->cap > 0 ? ab->cap * 2 : 4096;
+		while (cap < ab->len + n) cap *= 2;
+		char *b = (char *) realloc(ab->b, cap);
+		if (b == NULL) die("Failed at ab_append()");
+		ab->b = b;
+		ab->cap = cap;
+	}
+	memcpy(ab->b + ab->len, s, n);
+	ab->len += n;
+}
+
+// CSI n f into seq, the n left out when it is the default 1
+static int csi_n(char *seq, int n, char f){
+	if (n == 1) return snprintf(seq, 8, "\033[%c", f);
+	return snprintf(seq, 16, "\033[%d%c", n, f);
+}
+
+// (3) Move the cursor around -- into the frame output now, nothing is sent until the flush.
+// whatever is shortest from out_row/out_col: relative moves, CR, LF, BS or the absolute CUP.
+// the tty has OPOST off, so LF is just one row down in the same column
+static void ab_goto(struct ABUF *ab, int row, int col){
+	char best[32], seq[48], hor[16];
+	int n = snprintf(best, sizeof(best), "\033[%d;%dH", row + 1, col + 1);
+	if (out_row >= 0){
+		int len = 0;
+		if (row < out_row) len = csi_n(seq, out_row - row, 'A');
+		else if (row > out_row + 3) len = csi_n(seq, row - out_row, 'B');
+		else while (len < row - out_row) seq[len++] = '\n';
+		if (col != out_col){
+			int h = 0;
+			if (col == 0) hor[h++] = '\r';
+			else if (col == out_col - 1) hor[h++] = '\b';
+			else{ // CHA works from an unknown column too, CUF/CUB can be a digit shorter
+				h = csi_n(hor, col + 1, 'G');
+				char rel[16];
+				int r = out_col < 0 ? h : col > out_col ? csi_n(rel, col - out_col, 'C') : csi_n(rel, out_col - col, 'D');
+				if (r < h) memcpy(hor, rel, h = r);
+			}
+			memcpy(seq + len, hor, h);
+			len += h;
+		}
+		if (len < n) memcpy(best, seq, n = len);
+	}
+	ab_append(ab, best, n);
+	out_row = row;
+	out_col = col;
+}
+
+// the one write() of a frame, looping only if the tty takes it in pieces
+static void ab_flush(struct ABUF *ab){
+	double start = stat_start();
+	double began = now_ms();
+	int done = 0;
+	while (done < ab->len){
+		ssize_t n = write(STDOUT_FILENO, ab->b + done, ab->len - done);
+		screen_writes++;
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		done += n;
+	}
+	screen_bytes += done;
+	screen_write_ms = now_ms() - began;
+	ab->len = 0;
+	stat_stop(ST_FLUSH, start);
+}
+
+// ask the terminal how big it is and size both frames to match
+void screen_init(){
+	struct winsize size;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, (char *) &size) == 0 && size.ws_row > 0 && size.ws_col > 0){
+		screen_rows = size.ws_row;
+		screen_cols = size.ws_col;
+	}
+	free(frame_prev);
+	free(frame_next);
+	free(pen_prev);
+	free(pen_next);
+	free(cell_at);
+	free(row_bytes);
+	free(hash_prev);
+	free(hash_next);
+	free(row_len);
+	frame_prev = (unsigned *) malloc(screen_rows * screen_cols * sizeof(unsigned));
+	frame_next = (unsigned *) malloc(screen_rows * screen_cols * sizeof(unsigned));
+	pen_prev = (unsigned char *) malloc(screen_rows * screen_cols);
+	pen_next = (unsigned char *) malloc(screen_rows * screen_cols);
+	cell_at = (int *) malloc(screen_cols * sizeof(int));
+	row_bytes = (char *) malloc(screen_cols);
+	hash_prev = (unsigned *) malloc(screen_rows * sizeof(unsigned));
+	hash_next = (unsigned *) malloc(screen_rows * sizeof(unsigned));
+	row_len = (int *) malloc(screen_rows * sizeof(int));
+	if (frame_prev == NULL || frame_next == NULL || pen_prev == NULL || pen_next == NULL
+		|| cell_at == NULL || row_bytes == NULL || hash_prev == NULL || hash_next == NULL
+		|| row_len == NULL)
+		die("Failed at screen_init()");
+	frame_valid = 0;
+	hash_prev_ok = 0;
+}
+
+// move the viewport of win just enough to keep the cursor in it, returns the screen column the
+// cursor is in. view.left counts screen columns, not bytes
+static int scroll(){
+	if (win->cur.row < win->view.top) win->view.top = win->cur.row;
+	if (win->cur.row >= win->view.top + win->rows) win->view.top = win->cur.row - win->rows + 1;
+	int x = col_to_x(line_at(doc->buffer, win->cur.row), win->cur.col);
+	if (x < win->view.left) win->view.left = x;
+	if (x >= win->view.left + screen_cols) win->view.left = x - screen_cols + 1;
+	return x - win->view.left;
+}
+
+// the text of a line in one piece, copied into scratch only if the gap is in the way. Never NULL,
+// a new empty line has no str yet and regexec() wants a string even for nothing
+static const char *line_text(struct LINE *line, struct ABUF *scratch){
+	if (line->gap == line->len) return line->str != NULL ? line->str : "";
+	scratch->len = 0;
+	ab_append(scratch, line->str, line->gap);
+	ab_append(scratch, line_tail(line), line->len - line->gap);
+	return scratch->b;
+}
+
+// a char and the marks after it, s[i, j), as one cell
+static unsigned cell_marks(struct LINE *line, int i, int j){
+	unsigned char n = j - i < 255 ? j - i : 255;
+	char bytes[255];
+	line_copy(line, i, n, bytes);
+	unsigned cell = CELL_MARKS + marks_next.len;
+	ab_append(&marks_next, (char *) &n, 1);
+	ab_append(&marks_next, bytes, n);
+	return cell;
+}
+
+// the same cell on both frames: a code point, or the same bytes in their marks
+static int cell_same(unsigned a, unsigned b){
+	if (a < CELL_MARKS || b < CELL_MARKS) return a == b;
+	const char *p = marks_prev.b + (a - CELL_MARKS), *q = marks_next.b + (b - CELL_MARKS);
+	return p[0] == q[0] && memcmp(p + 1, q + 1, (unsigned char) p[0]) == 0;
+}
+
+// a line that isn't ASCII into width cells, from screen column left on. at[i] is the byte the
+// cell shows, the right half of a wide char gets CELL_WIDE and a char with marks on it goes to
+// marks_next. A wide char cut by either edge is a blank. Returns how many cells got filled
+static int draw_text(struct LINE *line, int left, int width, unsigned *cells, int *at){
+	int x = 0, n = 0;
+	for (int i = 0; i < line->len && n < width; ){
+		int cp, mark;
+		int k = line_cp(line, i, &cp);
+		int w = cp_width(cp);
+		int j = i + k; // past the marks on it
+		while (w > 0 && j < line->len){
+			int m = line_cp(line, j, &mark);
+			if (cp_width(mark) > 0) break;
+			j += m;
+		}
+		if (w > 0 && x + w > left){
+			at[n] = i;
+			if (x < left || x + w > left + width) cells[n++] = ' ';
+			else{
+				if (cp < 32 || cp == 127 || (cp >= 0x80 && cp < 0xA0)) cells[n++] = '?';
+				else cells[n++] = j > i + k ? cell_marks(line, i, j) : (unsigned) cp;
+				if (w == 2){
+					at[n] = i;
+					cells[n++] = CELL_WIDE;
+				}
+			}
+		}
+		x += w;
+		i = j;
+	}
+	return n;
+}
+
+// s[0, n) on the screen row cells, plain. The status line and the pager
+static void draw_plain(unsigned *cells, const char *s, int n, int left){
+	int k = 0;
+	if (find_high(s, n < left + screen_cols ? n : left + screen_cols) == NULL){ // bytes are columns
+		for (; k < screen_cols && left + k < n; k++){
+			unsigned char c = s[left + k];
+			cells[k] = c < 32 || c == 127 ? '?' : c;
+		}
+	}
+	else{
+		struct LINE tmp = {.len = n, .gap = n, .str = (char *) s};
+		k = draw_text(&tmp, left, screen_cols, cells, cell_at);
+	}
+	for (; k < screen_cols; k++) cells[k] = ' ';
+}
+
+// status_line on the bottom row of frame_next, if it is there
+static void draw_status(){
+	int rows = text_rows();
+	if (rows == screen_rows) return;
+	draw_plain(frame_next + rows * screen_cols, status_line, strlen(status_line), 0);
+	memset(pen_next + rows * screen_cols, PEN_PLAIN, screen_cols);
+}
+
+// CTRL-T in a grid-stats: the last frame, allocations and memory at the top right, over the text
+static void draw_stats(){
+	static double rss_at = -STAT_RSS_MS;
+	static long long rss = 0, allocs = 0;
+	if (!stats_shown) return;
+	if (now_ms() - rss_at >= STAT_RSS_MS){
+		rss = stat_rss();
+		rss_at = now_ms();
+	}
+	char text[128];
+	int n = snprintf(text, sizeof(text), " frame %.3f ms  %lld B  allocs %lld (+%lld)  rss %.1f MB ",
+		stat_frame_ms, stat_frame_bytes, stats[ST_ALLOC].n, stats[ST_ALLOC].n - allocs, rss / (1024.0 * 1024.0));
+	allocs = stats[ST_ALLOC].n;
+	if (n > screen_cols) n = screen_cols;
+	int at = screen_cols - n;
+	if (at > 0 && frame_next[at] == CELL_WIDE) frame_next[at - 1] = ' '; // no half a wide char
+	for (int i = 0; i < n; i++){
+		frame_next[at + i] = (unsigned char) text[i];
+		pen_next[at + i] = PEN_TIME;
+	}
+}
+
+// draw the visible part of the buffer into the rows of win in frame_next, the cost only depends
+// on the screen size. control chars show up as '?'. An ASCII line is a byte per cell, straight from
+// the line. the highlighter colors what is on screen, a blank is plain whatever it is in
+static void draw_rows(){
+	int rows = win->rows;
+	int state = hl_begin(win->view.top, win->view.top + rows); // what the top row starts in, a comment maybe
+	for (int r = 0; r < rows; r++){
+		unsigned *cells = frame_next + (win->top + r) * screen_cols;
+		unsigned char *pens = pen_next + (win->top + r) * screen_cols;
+		int n = 0;
+		if (win->view.top + r < doc->buf_line_no){
+			struct LINE *line = line_at(doc->buffer, win->view.top + r);
+			line_measure(line);
+			if (line->ascii){
+				n = line->len - win->view.left;
+				if (n < 0) n = 0;
+				if (n > screen_cols) n = screen_cols;
+				line_copy(line, win->view.left, n, row_bytes);
+				state = hl_color(line, state, pens, win->view.left, n);
+				for (int i = 0; i < n; i++){
+					unsigned char c = row_bytes[i];
+					cells[i] = c < 32 || c == 127 ? '?' : c;
+					if (c == ' ') pens[i] = PEN_PLAIN;
+				}
+			}
+			else{ // the bytes the cells show get colored, then each cell takes its first byte's pen
+				n = draw_text(line, win->view.left, screen_cols, cells, cell_at);
+				int from = 0, to = 0, cp;
+				if (n > 0){
+					from = cell_at[0];
+					to = cell_at[n - 1] + line_cp(line, cell_at[n - 1], &cp);
+				}
+				if (to - from > byte_pens_cap){
+					byte_pens_cap = to - from;
+					byte_pens = (unsigned char *) realloc(byte_pens, byte_pens_cap);
+					if (byte_pens == NULL) die("Failed at draw_rows()");
+				}
+				state = hl_color(line, state, byte_pens, from, to - from);
+				for (int i = 0; i < n; i++) pens[i] = cells[i] == ' ' ? PEN_PLAIN : byte_pens[cell_at[i] - from];
+			}
+		}
+		for (int i = n; i < screen_cols; i++) cells[i] = ' ';
+		memset(pens + n, PEN_PLAIN, screen_cols - n);
+	}
+}
+
+// cells[0, n) drawn in pens[0, n), as UTF-8: an SGR only where the pen changes.
+// *pen is what the terminal draws with now, blanks don't care so they never switch it.
+// returns 1 if it was all ASCII, so the cursor is sure to have moved n columns
+static int ab_cells(struct ABUF *ab, const unsigned *cells, const unsigned char *pens, int n, int *pen){
+	char run[256]; // text between two SGRs, a few bytes per cell
+	int len = 0;
+	int ascii = 1;
+	for (int i = 0; i < n; i++){
+		if (cells[i] >= 0x80) ascii = 0; // the terminal may not agree with us on its width
+		if (cells[i] == CELL_WIDE) continue; // drawn with its left half
+		if (cells[i] >= CELL_MARKS){ // too long for run maybe, it goes on its own
+			ab_append(ab, run, len);
+			len = 0;
+			if (pens[i] != *pen){
+				ab_append(ab, pen_sgr[pens[i]], strlen(pen_sgr[pens[i]]));
+				*pen = pens[i];
+			}
+			const char *marks = marks_next.b + (cells[i] - CELL_MARKS);
+			ab_append(ab, marks + 1, (unsigned char) marks[0]);
+			continue;
+		}
+		if (len > (int) sizeof(run) - 4 || (pens[i] != *pen && cells[i] != ' ')){
+			ab_append(ab, run, len);
+			len = 0;
+		}
+		if (pens[i] != *pen && cells[i] != ' '){
+			ab_append(ab, pen_sgr[pens[i]], strlen(pen_sgr[pens[i]]));
+			*pen = pens[i];
+		}
+		if (cells[i] < 0x80) run[len++] = cells[i];
+		else len += utf8_encode(cells[i], run + len);
+	}
+	ab_append(ab, run, len);
+	return ascii;
+}
+
+// a cell and its pen as one number for row_sum(). a cell with marks counts what it shows, its
+// offset into marks_prev or marks_next doesn't say
+static unsigned cell_key(unsigned cell, unsigned char pen, const struct ABUF *marks){
+	if (cell >= CELL_MARKS){
+		const char *m = marks->b + (cell - CELL_MARKS);
+		cell = 0;
+		for (int j = 0; j <= (unsigned char) m[0]; j++) cell = cell * 31 + (unsigned char) m[j];
+	}
+	return cell ^ (unsigned) pen << 24;
+}
+
+// a row hashed so frame_scroll() can match rows cheaply. four FNV chains a cell each in turn,
+// so the multiplies don't wait on each other
+static unsigned row_sum(const unsigned *cells, const unsigned char *pens, const struct ABUF *marks){
+	unsigned h0 = 2166136261u, h1 = h0, h2 = h0, h3 = h0;
+	int i = 0;
+	for (; i + 4 <= screen_cols; i += 4){
+		h0 = (h0 ^ cell_key(cells[i], pens[i], marks)) * 16777619u;
+		h1 = (h1 ^ cell_key(cells[i + 1], pens[i + 1], marks)) * 16777619u;
+		h2 = (h2 ^ cell_key(cells[i + 2], pens[i + 2], marks)) * 16777619u;
+		h3 = (h3 ^ cell_key(cells[i + 3], pens[i + 3], marks)) * 16777619u;
+	}
+	for (; i < screen_cols; i++) h0 = (h0 ^ cell_key(cells[i], pens[i], marks)) * 16777619u;
+	return h0 ^ h1 * 3 ^ h2 * 5 ^ h3 * 7;
+}
+
+// a row's width without its blank tail
+static int row_end(const unsigned *cells){
+	int end = screen_cols;
+	while (end > 0 && cells[end - 1] == ' ') end--;
+	return end;
+}
+
+// rows that only moved up or down (a line added or deleted, the view scrolled) are moved on the
+// terminal with a scroll region and DL/IL instead of being painted again. picks the one shift that
+// saves the most, frame_prev is shifted to match and the row diff takes it from there.
+// returns 1 if it hashed frame_next, which is hash_prev for the next frame
+static int frame_scroll(struct ABUF *ab){
+	int rows = 0; // a shift saves nothing before two rows changed
+	for (int r = 0; r < screen_rows && rows < 2; r++)
+		rows += memcmp(frame_prev + r * screen_cols, frame_next + r * screen_cols, screen_cols * sizeof(unsigned))
+			|| memcmp(pen_prev + r * screen_cols, pen_next + r * screen_cols, screen_cols) ? 1 : 0;
+	if (rows < 2) return 0;
+	unsigned *hp = hash_prev, *hn = hash_next;
+	int changed = 0; // all a scroll could save
+	for (int r = 0; r < screen_rows; r++){
+		if (!hash_prev_ok) hp[r] = row_sum(frame_prev + r * screen_cols, pen_prev + r * screen_cols, &marks_prev);
+		hn[r] = row_sum(frame_next + r * screen_cols, pen_next + r * screen_cols, &marks_next);
+		row_len[r] = row_end(frame_next + r * screen_cols);
+		if (hn[r] != hp[r]) changed += row_len[r];
+	}
+	if (changed <= SCROLL_COST) return 1;
+	// next[r] is prev[r + k] for r in [a, c]: what it saves is the rows that don't match unshifted,
+	// what it costs is the escape sequences and the rows the shift blanks that did match
+	int best = SCROLL_COST, best_k = 0, best_a = 0, best_c = 0;
+	for (int k = 1 - screen_rows; k < screen_rows; k++){
+		if (k == 0) continue;
+		int lo = k < 0 ? -k : 0, hi = k < 0 ? screen_rows - 1 : screen_rows - 1 - k;
+		int a = -1, gain = 0;
+		for (int r = lo; r <= hi + 1; r++){
+			if (r <= hi && hn[r] == hp[r + k]){
+				if (a < 0){
+					a = r;
+					gain = 0;
+				}
+				if (hn[r] != hp[r]) gain += row_len[r];
+				continue;
+			}
+			if (a < 0) continue;
+			int c = r - 1, from = k > 0 ? c + 1 : a + k, to = k > 0 ? c + k : a - 1;
+			for (int v = from; v <= to; v++) // blanked by the shift
+				if (hn[v] == hp[v]) gain -= row_len[v];
+			if (gain > best){
+				best = gain;
+				best_k = k;
+				best_a = a;
+				best_c = c;
+			}
+			a = -1;
+		}
+	}
+	if (best_k == 0) return 1;
+
+	int k = best_k, a = best_a, c = best_c;
+	int top = k > 0 ? a : a + k, bottom = k > 0 ? c + k : c; // the rows the shift touches
+	char seq[32];
+	if (bottom < screen_rows - 1){ // DECSTBM, rows past bottom stay put. it homes the cursor
+		ab_append(ab, seq, snprintf(seq, sizeof(seq), "\033[1;%dr", bottom + 1));
+		out_row = out_col = 0;
+	}
+	ab_goto(ab, top, 0);
+	ab_append(ab, seq, csi_n(seq, k > 0 ? k : -k, k > 0 ? 'M' : 'L'));
+	out_col = -1; // DL/IL go to the left margin, on most terminals
+	if (bottom < screen_rows - 1){
+		ab_append(ab, "\033[r", 3);
+		out_row = out_col = 0;
+	}
+
+	int n = (c - a + 1) * screen_cols, blank = (k > 0 ? c + 1 : a + k) * screen_cols;
+	memmove(frame_prev + a * screen_cols, frame_prev + (a + k) * screen_cols, n * sizeof(unsigned));
+	memmove(pen_prev + a * screen_cols, pen_prev + (a + k) * screen_cols, n);
+	for (int i = 0; i < abs(k) * screen_cols; i++) frame_prev[blank + i] = ' ';
+	memset(pen_prev + blank, PEN_PLAIN, abs(k) * screen_cols);
+	return 1;
+}
+
+// diff frame_next against what is on screen, send the difference and the cursor in one write()
+// the first and last cell of row r that changed, 0 if none did
+static int row_diff(int r, int *first, int *last){
+	unsigned *prev = frame_prev + r * screen_cols;
+	unsigned *next = frame_next + r * screen_cols;
+	unsigned char *pprev = pen_prev + r * screen_cols;
+	unsigned char *pnext = pen_next + r * screen_cols;
+	int f = 0, l = screen_cols - 1;
+	if (marks_prev.len == 0 && marks_next.len == 0){ // the same numbers are the same cells
+		if (memcmp(prev, next, screen_cols * sizeof(unsigned)) == 0 && memcmp(pprev, pnext, screen_cols) == 0)
+			return 0;
+		while (prev[f] == next[f] && pprev[f] == pnext[f]) f++;
+	}
+	else{
+		while (f < screen_cols && cell_same(prev[f], next[f]) && pprev[f] == pnext[f]) f++;
+		if (f == screen_cols) return 0;
+	}
+	while (cell_same(prev[l], next[l]) && pprev[l] == pnext[l]) l--;
+	*first = f;
+	*last = l;
+	return 1;
+}
+
+// chars typed or deleted inside a line push the rest of it over: ICH/DCH shift what the terminal
+// shows instead of it being painted again. only on ASCII, where its widths and ours surely agree
+static int row_shift(struct ABUF *ab, int r, int first){
+	unsigned *prev = frame_prev + r * screen_cols;
+	unsigned *next = frame_next + r * screen_cols;
+	unsigned char *pprev = pen_prev + r * screen_cols;
+	unsigned char *pnext = pen_next + r * screen_cols;
+	for (int i = first; i < screen_cols; i++)
+		if (prev[i] >= 0x80 || next[i] >= 0x80) return 0;
+	for (int d = 1; d <= SHIFT_MAX && first + d < screen_cols; d++){
+		for (int ins = 0; ins < 2; ins++){ // cells [first, cols - d) move right by d, or left
+			const unsigned *from = ins ? prev : prev + d, *to = ins ? next + d : next;
+			const unsigned char *pfrom = ins ? pprev : pprev + d, *pto = ins ? pnext + d : pnext;
+			int i = first, n = screen_cols - d;
+			while (i < n && from[i] == to[i] && pfrom[i] == pto[i]) i++;
+			// worth it if more moves than an ICH/DCH costs
+			if (i < n || row_end(next) - first - d <= SKIP_CELLS) continue;
+			char seq[16];
+			ab_goto(ab, r, first);
+			ab_append(ab, seq, csi_n(seq, d, ins ? '@' : 'P'));
+			if (ins){
+				memmove(prev + first + d, prev + first, (n - first) * sizeof(unsigned));
+				memmove(pprev + first + d, pprev + first, n - first);
+				for (int j = first; j < first + d; j++) prev[j] = ' ';
+				memset(pprev + first, PEN_PLAIN, d);
+			}
+			else{
+				memmove(prev + first, prev + first + d, (n - first) * sizeof(unsigned));
+				memmove(pprev + first, pprev + first + d, n - first);
+				for (int j = n; j < screen_cols; j++) prev[j] = ' ';
+				memset(pprev + n, PEN_PLAIN, d);
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void frame_send(int cur_row, int cur_col){
+	double start = stat_start();
+	struct ABUF *ab = &screen_out;
+	int body = ab->len; // where the frame's own bytes start
+	int fresh = !frame_valid, hashed = 0; // a blank frame_prev has nothing to scroll or shift
+	if (!frame_valid){ // nothing known about the screen, wipe it so frame_prev can be all blanks
+		ab_append(ab, "\033[2J", 4);
+		for (int i = 0; i < screen_rows * screen_cols; i++) frame_prev[i] = ' ';
+		memset(pen_prev, PEN_PLAIN, screen_rows * screen_cols);
+		frame_valid = 1;
+		out_row = out_col = -1;
+	}
+
+	int pen = PEN_PLAIN; // a frame starts and ends plain
+	if (!fresh) hashed = frame_scroll(ab);
+	for (int r = 0; r < screen_rows; r++){
+		unsigned *prev = frame_prev + r * screen_cols;
+		unsigned *next = frame_next + r * screen_cols;
+		unsigned char *pprev = pen_prev + r * screen_cols;
+		unsigned char *pnext = pen_next + r * screen_cols;
+		int first, last; // first and last cell that changed
+		if (!row_diff(r, &first, &last)) continue;
+		if (!fresh && row_shift(ab, r, first) && !row_diff(r, &first, &last)) continue;
+		// a wide char is written whole: from its left half, and past its right half
+		if (first > 0 && (prev[first] == CELL_WIDE || next[first] == CELL_WIDE)) first--;
+		if (last < screen_cols - 1 && next[last + 1] == CELL_WIDE) last++;
+		int end = row_end(next); // cells from end on are blank in the new row
+
+		// the changed cells go out in runs, SKIP_CELLS unchanged ones in a row are cheaper to move over
+		for (int c = first; ; ){
+			int e = c, same = 0; // the run is [c, e]
+			for (int i = c + 1; i <= last && same < SKIP_CELLS; i++){
+				if (cell_same(prev[i], next[i]) && pprev[i] == pnext[i]) same++;
+				else{
+					same = 0;
+					e = i;
+				}
+			}
+			if (e < screen_cols - 1 && next[e + 1] == CELL_WIDE) e++;
+			ab_goto(ab, r, c);
+			int ascii = 1, erased = e >= end;
+			if (erased){ // the run goes into the blank tail: paint up to it, erase the rest
+				if (end > c) ascii = ab_cells(ab, next + c, pnext + c, end - c, &pen);
+				ab_append(ab, "\033[K", 3); // pens are foreground only, any of them erases to the same blank
+				e = end > c ? end - 1 : c - 1;
+			}
+			else ascii = ab_cells(ab, next + c, pnext + c, e - c + 1, &pen);
+			// past the last column the cursor waits to wrap, and wider chars than we think could wrap it
+			if (!ascii) out_row = out_col = -1;
+			else out_col = e + 1 < screen_cols ? e + 1 : -1;
+			if (erased) break;
+			for (c = e + 1; c <= last && cell_same(prev[c], next[c]) && pprev[c] == pnext[c]; c++);
+			if (c > last) break;
+			if (prev[c] == CELL_WIDE || next[c] == CELL_WIDE) c--;
+		}
+	}
+	if (pen != PEN_PLAIN) ab_append(ab, pen_sgr[PEN_PLAIN], strlen(pen_sgr[PEN_PLAIN]));
+
+	ab_goto(ab, cur_row, cur_col);
+	if (ab->len - body > HIDE_BYTES){ // no cursor flicker while rows are painted, put in front after all
+		ab_append(ab, "\033[?25l", 6);
+		memmove(ab->b + body + 6, ab->b + body, ab->len - body - 6);
+		memcpy(ab->b + body, "\033[?25l", 6);
+		ab_append(ab, "\033[?25h", 6);
+	}
+	stat_stop(ST_DIFF, start);
+	ab_flush(ab);
+
+	struct ABUF marks = marks_prev;
+	marks_prev = marks_next;
+	marks_next = marks;
+	marks_next.len = 0;
+	unsigned *temp = frame_prev; // what we drew is what the terminal shows now
+	frame_prev = frame_next;
+	frame_next = temp;
+	unsigned char *ptemp = pen_prev;
+	pen_prev = pen_next;
+	pen_next = ptemp;
+	unsigned *htemp = hash_prev;
+	hash_prev = hash_next;
+	hash_next = htemp;
+	hash_prev_ok = hashed;
+}
+
+// stack the windows on the text rows, each gets a bar under it unless it is the only one.
+// A terminal too small for all of them leaves the last ones without rows
+static void win_layout(){
+	int n = 0;
+	for (struct WIN *w = wins; w != NULL; w = w->next) n++;
+	int total = text_rows(), top = 0, k = 0;
+	for (struct WIN *w = wins; w != NULL; w = w->next, k++){
+		int band = total / n + (k < total % n); // the spare rows go to the top ones
+		w->top = top;
+		w->rows = n == 1 ? band : band > 1 ? band - 1 : 0;
+		top += band;
+	}
+}
+
+// the bar under win: the file name, in '=' for the window that has the keys
+static void win_bar(int active){
+	int row = win->top + win->rows;
+	if (wins->next == NULL || row >= text_rows()) return;
+	char bar[512];
+	int n = snprintf(bar, sizeof(bar), "%s %s ", active ? "==" : "--", doc->name);
+	if (n >= (int) sizeof(bar)) n = sizeof(bar) - 1;
+	memset(bar + n, active ? '=' : '-', sizeof(bar) - 1 - n);
+	draw_plain(frame_next + row * screen_cols, bar, sizeof(bar) - 1, 0);
+	memset(pen_next + row * screen_cols, PEN_PLAIN, screen_cols);
+}
+
+// draw, diff against what is on screen, send the difference in one write()
+void refresh_screen(){
+	double start = stat_start();
+	long long bytes = screen_bytes;
+	if (pager){ // grid -R has no buffer, it draws straight from the map
+		pager_draw();
+		stat_frame(start, screen_bytes - bytes);
+		return;
+	}
+	int x = 0;
+	win_layout();
+	for (struct WIN *w = wins; w != NULL; w = w->next){ // every window goes into the one frame
+		struct WIN *was = win_use(w);
+		int wx = scroll();
+		draw_rows();
+		win_bar(w == was);
+		win_use(was);
+		if (w == win) x = wx;
+	}
+	draw_status();
+	draw_stats();
+	frame_send(win->top + win->cur.row - win->view.top, x);
+	stat_frame(start, screen_bytes - bytes);
+}
+
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| INPUT - batched read() and key decoding |-----------------------*/
+/* one read() takes whatever the tty has (up to INPUT_MAX), keys are decoded out of in_buf and the
+ * screen is redrawn once per batch. A run of plain text, or a bracketed paste, comes out as a
+ * single KEY_PASTE so it goes into the buffer with one insert_text() */
+#define INPUT_MAX 65536
+#define ESC_WAIT_MS 25 // how long a lone ESC waits for the rest of its sequence
+
+enum KEY{ // keys that take more than one byte, numbered above any byte
+	KEY_NONE = -1,
+	KEY_UP = 1000,
+	KEY_DOWN,
+	KEY_RIGHT,
+	KEY_LEFT,
+	KEY_HOME,
+	KEY_END,
+	KEY_PGUP,
+	KEY_PGDN,
+	KEY_DEL,
+	KEY_PASTE // text is in paste_buf
+};
+
+static unsigned char in_buf[INPUT_MAX];
+static int in_len = 0; // bytes in in_buf
+static int in_pos = 0; // next byte to decode
+static struct ABUF paste_buf = {NULL, 0, 0}; // text of the last KEY_PASTE
+
+// read() more into in_buf, wait_ms < 0 blocks, otherwise poll() that long first
+// returns bytes read, 0 if nothing came in time, -1 on error (errno EINTR for a signal)
+static int input_fill(int wait_ms){
+	if (in_pos == in_len) in_pos = in_len = 0;
+	if (in_len == INPUT_MAX && in_pos > 0){ // make room at the end
+		memmove(in_buf, in_buf + in_pos, in_len - in_pos);
+		in_len -= in_pos;
+		in_pos = 0;
+	}
+	if (wait_ms >= 0){
+		struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+		int ready = poll(&pfd, 1, wait_ms);
+		if (ready <= 0) return ready;
+	}
+	int n = read(STDIN_FILENO, in_buf + in_len, INPUT_MAX - in_len);
+	if (n > 0) in_len += n;
+	return n;
+}
+
+// does this byte go into the text as it is?
+static int is_text(unsigned char c){
+	return c >= 32 ? c != 127 : (c == '\t' || c == '\n' || c == '\r');
+}
+
+// gather a bracketed paste up to ESC[201~ into paste_buf, reading more while it is still coming
+static void read_paste(){
+	static const char end_mark[] = "\033[201~";
+	paste_buf.len = 0;
+	for (;;){
+		unsigned char *from = in_buf + in_pos;
+		unsigned char *found = memmem(from, in_len - in_pos, end_mark, 6);
+		if (found != NULL){
+			ab_append(&paste_buf, (char *) from, found - from);
+			in_pos = found - in_buf + 6;
+			return;
+		}
+		int keep = in_len - in_pos < 5 ? in_len - in_pos : 5; // could be the start of the end mark
+		ab_append(&paste_buf, (char *) from, in_len - in_pos - keep);
+		in_pos = in_len - keep;
+		if (input_fill(-1) <= 0 && errno != EINTR) return; // input is gone, keep what we got
+	}
+}
+
+// decode the next key out of in_buf, KEY_NONE once the batch is used up
+static int input_decode(){
+	if (in_pos == in_len) return KEY_NONE;
+	unsigned char c = in_buf[in_pos];
+
+	if (c != '\033'){
+		int run = in_pos;
+		while (run < in_len && is_text(in_buf[run])) run++;
+		if (run - in_pos < 2){ // a single key
+			in_pos++;
+			return c;
+		}
+		paste_buf.len = 0; // typed faster than a frame, or pasted: all of it in one go
+		ab_append(&paste_buf, (char *) in_buf + in_pos, run - in_pos);
+		in_pos = run;
+		return KEY_PASTE;
+	}
+
+	// ESC [ params final, the rest of it may still be on the way
+	int i = in_pos + 1;
+	for (;;){
+		if (i == in_len){
+			int k = i - in_pos; // input_fill() may slide in_buf down
+			int got = input_fill(ESC_WAIT_MS);
+			i = in_pos + k;
+			if (got <= 0) break;
+		}
+		if (i == in_pos + 1 && in_buf[i] != '[' && in_buf[i] != 'O') break; // not a sequence
+		if (i > in_pos + 1 && in_buf[i] >= 0x40 && in_buf[i] <= 0x7e) break; // final byte
+		i++;
+	}
+	if (i >= in_len || i == in_pos + 1){ // lone ESC
+		in_pos++;
+		return '\033';
+	}
+
+	unsigned char final = in_buf[i];
+	int param = atoi((char *) in_buf + in_pos + 2); // only used by ESC [ n ~
+	in_pos = i + 1;
+	switch (final){
+		case 'A': return KEY_UP;
+		case 'B': return KEY_DOWN;
+		case 'C': return KEY_RIGHT;
+		case 'D': return KEY_LEFT;
+		case 'H': return KEY_HOME;
+		case 'F': return KEY_END;
+		case '~':
+			switch (param){
+				case 1: case 7: return KEY_HOME;
+				case 4: case 8: return KEY_END;
+				case 3: return KEY_DEL;
+				case 5: return KEY_PGUP;
+				case 6: return KEY_PGDN;
+				case 200:
+					read_paste();
+					return KEY_PASTE;
+			}
+	}
+	return KEY_NONE; // some sequence we don't use, swallowed
+}
+
+// input_decode(), timed for STATS
+int input_key(){
+	double start = stat_start();
+	int c = input_decode();
+	stat_stop(ST_DECODE, start);
+	return c;
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| LOADER - the rest of the file on a thread |---------------------*/
+/* file_to_buffer_bg() makes the first screenful of lines itself and leaves the rest to this
+ * thread, so the first frame doesn't wait for the file. The loader fills leaves of its own, carved
+ * from arena blocks nobody else touches, and hands them over LOAD_BATCH at a time. It never
+ * touches the tree: the main thread hangs the leaves on at the end when the self-pipe wakes it
+ * (WAKE_LOAD), and whatever needs lines that aren't there yet waits in load_wait() for just those */
+#define LOAD_BATCH 256 // leaves per hand over, ~24K lines
+#define WAKE_LOAD 0 // written to the self-pipe, no signal has number 0
+
+int loading = 0; // the loader thread is running
+static pthread_t load_thread;
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t load_more = PTHREAD_COND_INITIALIZER;
+static struct DOC *load_doc; // the document it loads
+static char *load_from; // where the loader starts
+static volatile int load_stop = 0; // main thread wants it to quit early
+static double load_start_ms;
+// handed over, under load_lock
+static struct NODE **load_ready = NULL;
+static int load_nready = 0;
+static int load_cap = 0;
+static char *load_blocks = NULL; // blocks the leaves live in, chained like the arena's
+static size_t load_bytes = 0; // of the file scanned so far
+static int load_finished = 0;
+
+// loader's own node_new(), blocks go to the main thread's arena once they are full
+static char *load_block = NULL;
+static size_t load_used = ARENA_BLOCK;
+static char *load_full = NULL;
+
+static struct NODE *load_leaf(){
+	size_t size = (sizeof(struct NODE) + 15) & ~(size_t) 15;
+	if (load_used + size > ARENA_BLOCK){
+		if (load_block != NULL){
+			*(char **) load_block = load_full;
+			load_full = load_block;
+		}
+		load_block = (char *) malloc(ARENA_BLOCK);
+		if (load_block == NULL) die("Failed at load_leaf()");
+		load_used = 16;
+	}
+	struct NODE *obj = (struct NODE *)(load_block + load_used);
+	load_used += size;
+	memset(obj, 0, offsetof(struct NODE, kids));
+	obj->leaf = 1;
+	return obj;
+}
+
+// hand over what is done, the whole lot of blocks with the last batch
+static void load_publish(struct NODE **leaves, int n, size_t bytes, int finished){
+	pthread_mutex_lock(&load_lock);
+	if (load_nready + n > load_cap){
+		load_cap = (load_nready + n) * 2;
+		load_ready = (struct NODE **) realloc(load_ready, load_cap * sizeof(struct NODE *));
+		if (load_ready == NULL) die("Failed at load_publish()");
+	}
+	memcpy(load_ready + load_nready, leaves, n * sizeof(struct NODE *));
+	load_nready += n;
+	if (finished && load_block != NULL){
+		*(char **) load_block = load_full;
+		load_full = load_block;
+		load_block = NULL;
+	}
+	while (load_full != NULL){
+		char *next = *(char **) load_full;
+		*(char **) load_full = load_blocks;
+		load_blocks = load_full;
+		load_full = next;
+	}
+	load_bytes = bytes;
+	load_finished = finished;
+	pthread_cond_signal(&load_more);
+	pthread_mutex_unlock(&load_lock);
+
+	int saved = errno;
+	unsigned char b = WAKE_LOAD;
+	if (write(sig_pipe[1], &b, 1) < 0){} // full: the loop is awake anyway
+	errno = saved;
+}
+
+// the same lines file_map_scan() makes, a leaf at a time
+static void *load_main(void *arg){
+	struct NODE *batch[LOAD_BATCH];
+	int n = 0;
+	char *s = load_from;
+	char *end = load_doc->file_map + load_doc->file_map_size;
+	const char *clean = s;
+	while (s < end && !load_stop){
+		struct NODE *leaf = batch[n++] = load_leaf();
+		while (leaf->n < NODE_FILL && s < end){
+			char *nl = memchr(s, '\n', end - s);
+			if (nl == NULL) nl = end;
+			struct LINE *line = &leaf->lines[leaf->n++];
+			memset(line, 0, sizeof(struct LINE));
+			line->len = line->gap = nl - s;
+			line->str = s;
+			map_line_measure(line, &clean, end);
+			s = nl < end ? nl + 1 : end;
+		}
+		leaf->count = leaf->n;
+		if (n == LOAD_BATCH && s < end){
+			load_publish(batch, n, s - load_doc->file_map, 0);
+			n = 0;
+		}
+	}
+	madvise(load_doc->file_map, load_doc->file_map_size, MADV_NORMAL);
+	load_publish(batch, n, s - load_doc->file_map, 1);
+	return NULL;
+}
+
+void load_start(char *from){
+	load_doc = doc;
+	load_from = from;
+	load_stop = 0;
+	load_finished = 0;
+	load_start_ms = now_ms();
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old); // signals stay with the main thread
+	if (pthread_create(&load_thread, NULL, load_main, NULL) != 0) die("pthread_create error");
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	loading = 1;
+}
+
+// hang whatever the loader handed over onto the tree, main thread only
+static void load_collect(){
+	if (!loading) return;
+	pthread_mutex_lock(&load_lock);
+	struct NODE **leaves = load_ready;
+	int n = load_nready;
+	char *blocks = load_blocks;
+	size_t bytes = load_bytes;
+	int finished = load_finished;
+	load_ready = NULL;
+	load_nready = load_cap = 0;
+	load_blocks = NULL;
+	pthread_mutex_unlock(&load_lock);
+
+	for (int i = 0; i < n; i++){
+		tree_append_leaf(&load_doc->buffer, leaves[i]);
+		load_doc->file_rows += leaves[i]->count;
+		load_doc->buf_line_no += leaves[i]->count;
+	}
+	free(leaves);
+	while (blocks != NULL){
+		char *next = *(char **) blocks;
+		arena_adopt(blocks);
+		blocks = next;
+	}
+	if (finished){
+		pthread_join(load_thread, NULL);
+		loading = 0;
+		if (load_doc == docs) load_ms = first_ms + now_ms() - load_start_ms; // the numbers are the first file's
+		if (strncmp(status_line, "loading ", 8) == 0) status_line[0] = '\0'; // only the progress goes
+	}
+	else if (!prompt_active()) // a prompt on the status line stays, the progress waits for it to go
+		snprintf(status_line, sizeof(status_line), "loading %d%%  %d lines",
+			(int)(bytes * 100 / load_doc->file_map_size), load_doc->buf_line_no);
+	screen_stale = 1;
+}
+
+// return once row of load_doc is loaded, or the whole file is in if it doesn't have that many lines
+static void load_until(int row){
+	while (loading && row >= load_doc->buf_line_no){
+		pthread_mutex_lock(&load_lock);
+		while (load_nready == 0 && !load_finished) pthread_cond_wait(&load_more, &load_lock);
+		pthread_mutex_unlock(&load_lock);
+		load_collect();
+	}
+}
+
+// the same for row of doc, any other document is in already
+void load_wait(int row){
+	if (doc == load_doc) load_until(row);
+}
+
+// stop the loader where it is, for exit
+void load_cancel(){
+	if (!loading) return;
+	load_stop = 1;
+	load_until(INT_MAX);
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| EVENT LOOP - poll(), timers, idle work |------------------------*/
+/* one poll() waits on the tty and the signal self-pipe, its timeout is the next timer on the wheel,
+ * or zero while there is idle work queued. Idle work runs in short slices between polls so a key
+ * press never waits behind it for more than IDLE_SLICE_MS.
+ * Frames are scheduled: input is applied as it comes and a frame goes out when one is due, so a
+ * held key draws the state after all the repeats that arrived, not each of them. Frames are
+ * frame_gap apart, FRAME_MIN_MS while the terminal keeps up. A write() that blocks means the tty
+ * is full: frames then go at the speed the link was measured at, up to FRAME_MAX_MS apart, so the
+ * link isn't busy with frames nobody will look at and a slow one shows where the cursor is now */
+#define WHEEL_SLOTS 256
+#define WHEEL_TICK_MS 10 // timer resolution
+#define IDLE_SLICE_MS 4 // idle work checks back with poll() at least this often
+#define IDLE_MAX 8
+#define FRAME_MIN_MS 8 // frames never come closer than this
+#define FRAME_MAX_MS 250 // nor further apart, however slow the terminal
+#define FRAME_BLOCKED_MS 2 // a write() this long waited for the tty, copying a frame takes far less
+#define FRAME_RATE_MS 2000 // two full ttys further apart than this say nothing about the link now
+
+struct TIMER{
+	long tick; // wheel tick it fires on
+	int period; // ms between runs, 0 fires once
+	void (*fn)(void *arg);
+	void *arg;
+	struct TIMER *next; // next timer in the same slot
+};
+
+static struct TIMER *wheel[WHEEL_SLOTS]; // hashed by tick, a slot holds every lap of the wheel
+static long wheel_tick = 0; // last tick that has run
+static double wheel_start = 0; // now_ms() at tick 0
+static int timer_count = 0;
+
+static int (*idle_work[IDLE_MAX])(double until); // returns 1 while it has more to do
+static int idle_count = 0;
+int watch_fd = -1; // inotify of a followed file, its events go to pager_watch()
+static double frame_gap = FRAME_MIN_MS; // ms between two frames, grows while write() blocks
+static double frame_at = 0; // when the last frame went out
+static double link_full_at = 0; // when a write() last blocked, the tty was full then
+static long long link_full_bytes = 0; // screen_bytes at that moment
+static double link_rate = 0; // bytes per ms the terminal takes, 0 until measured
+
+static long tick_of(double ms){
+	return (long)((ms - wheel_start) / WHEEL_TICK_MS);
+}
+
+static void timer_link(struct TIMER *t){
+	int slot = t->tick % WHEEL_SLOTS;
+	t->next = wheel[slot];
+	wheel[slot] = t;
+}
+
+// fn(arg) runs after ms, then every period ms if period > 0. One-shot timers free themselves
+struct TIMER *timer_add(int ms, int period, void (*fn)(void *arg), void *arg){
+	struct TIMER *t = malloc(sizeof(struct TIMER));
+	if (t == NULL) die("malloc error");
+	if (wheel_start == 0) wheel_start = now_ms();
+	t->tick = tick_of(now_ms() + ms);
+	if (t->tick <= wheel_tick) t->tick = wheel_tick + 1;
+	t->period = period;
+	t->fn = fn;
+	t->arg = arg;
+	timer_link(t);
+	timer_count++;
+	return t;
+}
+
+// stop a timer that hasn't fired yet (or a periodic one, also from inside its own fn)
+void timer_del(struct TIMER *t){
+	struct TIMER **p = &wheel[t->tick % WHEEL_SLOTS];
+	while (*p != NULL && *p != t) p = &(*p)->next;
+	if (*p == NULL) return;
+	*p = t->next;
+	free(t);
+	timer_count--;
+}
+
+// run every timer that is due, a long stall walks each slot at most once
+static void timer_run(){
+	if (timer_count == 0) return;
+	long now = tick_of(now_ms());
+	long last = now - wheel_tick > WHEEL_SLOTS ? wheel_tick + WHEEL_SLOTS : now;
+	struct TIMER *due = NULL;
+	for (long tick = wheel_tick + 1; tick <= last; tick++){ // unlink first, fns may add or delete timers
+		struct TIMER **p = &wheel[tick % WHEEL_SLOTS];
+		while (*p != NULL){
+			struct TIMER *t = *p;
+			if (t->tick > now){ // a later lap
+				p = &t->next;
+				continue;
+			}
+			*p = t->next;
+			t->next = due;
+			due = t;
+		}
+	}
+	wheel_tick = now;
+	while (due != NULL){
+		struct TIMER *t = due;
+		due = t->next;
+		if (t->period > 0){ // back on the wheel before fn, so fn can timer_del() it
+			t->tick = now + (t->period + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+			timer_link(t);
+			t->fn(t->arg);
+		} else {
+			timer_count--;
+			t->fn(t->arg);
+			free(t);
+		}
+	}
+}
+
+// poll() timeout: ms until the first slot with anything in it, -1 with no timers
+static int timer_timeout(){
+	if (timer_count == 0) return -1;
+	for (long tick = wheel_tick + 1; tick <= wheel_tick + WHEEL_SLOTS; tick++){
+		if (wheel[tick % WHEEL_SLOTS] == NULL) continue;
+		double ms = wheel_start + tick * WHEEL_TICK_MS - now_ms();
+		return ms > 0 ? (int)ms + 1 : 0; // a later lap only costs an early wakeup
+	}
+	return WHEEL_SLOTS * WHEEL_TICK_MS;
+}
+
+// ms until the next frame may go out, 0 if it may go now
+static int frame_wait(){
+	double now = now_ms();
+	if (now < frame_at + frame_gap) return (int)(frame_at + frame_gap - now) + 1;
+	return 0;
+}
+
+// a frame of bytes went out and spent write_ms in write(). A write() that blocked found the tty
+// full, and everything written since the last time it was full has gone through the link in
+// between: that is its speed, and frames go a quarter slower than it so the backlog drains.
+// While the terminal keeps up the gap shrinks a little every frame, until it doesn't
+static void frame_sent(double write_ms, long long bytes){
+	frame_at = now_ms();
+	if (write_ms >= FRAME_BLOCKED_MS){
+		if (link_full_at > 0 && frame_at - link_full_at < FRAME_RATE_MS)
+			link_rate = (screen_bytes - link_full_bytes) / (frame_at - link_full_at);
+		link_full_at = frame_at;
+		link_full_bytes = screen_bytes;
+		frame_gap = link_rate > 0 ? bytes / link_rate * 5 / 4 : write_ms;
+	}
+	else frame_gap = frame_gap * 15 / 16;
+	if (frame_gap < FRAME_MIN_MS) frame_gap = FRAME_MIN_MS;
+	if (frame_gap > FRAME_MAX_MS) frame_gap = FRAME_MAX_MS;
+}
+
+// queue fn to run when there is no input, fn(until) should return by now_ms() >= until
+void idle_add(int (*fn)(double until)){
+	for (int i = 0; i < idle_count; i++) if (idle_work[i] == fn) return;
+	if (idle_count == IDLE_MAX) die("idle_add: too much idle work");
+	idle_work[idle_count++] = fn;
+}
+
+// one slice of idle work, whatever is done drops off the queue
+static void idle_run(){
+	double until = now_ms() + IDLE_SLICE_MS;
+	for (int i = 0; i < idle_count && now_ms() < until; ){
+		if (idle_work[i](until)){
+			i++;
+			continue;
+		}
+		memmove(idle_work + i, idle_work + i + 1, (idle_count - i - 1) * sizeof(idle_work[0]));
+		idle_count--;
+	}
+}
+
+/* returns why it stopped: 021 for CTRL-Q, a signal number, 0 when the tty read fails or hits EOF */
+int event_loop(){
+	for (;;){
+		int wait = screen_stale ? frame_wait() : -1;
+		if (wait == 0){ // once for everything that happened since the last frame
+			long long bytes = screen_bytes;
+			screen_stale = 0;
+			refresh_screen();
+			frame_sent(screen_write_ms, screen_bytes - bytes);
+			wait = -1;
+		}
+		struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {sig_pipe[0], POLLIN, 0}, {watch_fd, POLLIN, 0}};
+		int timeout = idle_count > 0 ? 0 : timer_timeout();
+		if (wait > 0 && (timeout < 0 || wait < timeout)) timeout = wait; // wake up for the frame
+		int ready = poll(fds, 3, timeout); // poll() skips watch_fd -1
+		if (ready < 0 && errno != EINTR) return 0;
+
+		if (ready > 0 && (fds[2].revents & POLLIN)) pager_watch();
+
+		if (ready > 0 && (fds[1].revents & POLLIN)){
+			unsigned char signo;
+			while (read(sig_pipe[0], &signo, 1) == 1){
+				if (signo == WAKE_LOAD) load_collect(); // more lines from the loader
+				else if (signo != SIGWINCH) return signo;
+				else {
+					screen_init(); // new size: resize the frames and redraw, the buffer is untouched
+					screen_stale = 1;
+				}
+			}
+		}
+		if (ready > 0 && fds[0].revents){ // POLLIN, or POLLHUP/POLLERR which read() reports
+			int n = input_fill(-1); // as many bytes as there are, at least one
+			if (n <= 0 && !(n < 0 && errno == EINTR)) return 0;
+			int c;
+			while ((c = input_key()) != KEY_NONE || in_pos < in_len){
+				if (c == 021) return 021; /* 021 = CTRL-Q */
+				if (c != KEY_NONE) handle_input(c);
+			}
+			screen_stale = 1;
+		}
+		timer_run();
+		if (ready == 0 && idle_count > 0) idle_run();
+	}
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| JOURNAL - swap file of edits |----------------------------------*/
+/* every edit goes into <file>.grid-swp as a small record: insert bytes at row col, or delete n bytes
+ * forward from row col. Records pile up in jn_buf and reach the disk once a second, so the cost
+ * follows what was typed, not the size of the file. Starting grid on a file that has a swap file
+ * replays it onto the file, that is the crash recovery. A swap file that grows too big is rewritten
+ * as a snapshot: runs of untouched lines as offsets into the file, plus the text of dirty lines */
+#define JN_FLUSH_MS 1000
+#define JN_COMPACT (1 << 20) // swap file size before a snapshot is worth it
+#define JN_MAGIC "GRIDSWP1"
+#define JN_HEAD 24 // magic, file size, file mtime: replay only onto the file it was written for
+
+enum JREC{ // the byte each record starts with
+	JN_INSERT = 'i', // row, col, len (int each), then len bytes
+	JN_DELETE = 'd', // row, col, len
+	JN_SNAP = 's', // the buffer is rebuilt from the records up to JN_SNAP_END
+	JN_COPY = 'c', // off, len (long long each): lines straight out of the file, '\n' between them
+	JN_TEXT = 't', // len (int), then len bytes: one line
+	JN_SNAP_END = 'e'
+};
+
+static char jn_name[4096];
+static int jn_fd = -1; // opened with the first flush
+static struct ABUF jn_buf = {NULL, 0, 0}; // records not written yet
+static int jn_last = -1; // where the last record starts in jn_buf, a typing run grows it in place
+static long long jn_size = 0; // bytes in the swap file
+static long long jn_snap = 0; // size of the last snapshot, taken or not, the next one waits for 4x
+static long long jn_file_size = 0; // the file the records apply to
+static long long jn_file_mtime = 0;
+long jn_ops = 0; // edits since the file was loaded
+long jn_replayed = 0; // records replayed when it was loaded
+
+static void jn_rec(struct ABUF *ab, int type, int row, int col, int len){
+	char rec[13];
+	rec[0] = type;
+	memcpy(rec + 1, &row, 4);
+	memcpy(rec + 5, &col, 4);
+	memcpy(rec + 9, &len, 4);
+	ab_append(ab, rec, 13);
+}
+
+static void jn_header(struct ABUF *ab){
+	ab_append(ab, JN_MAGIC, 8);
+	ab_append(ab, (char *)&jn_file_size, 8);
+	ab_append(ab, (char *)&jn_file_mtime, 8);
+}
+
+// s[0, n) went in at row col, typing straight on from the last insert just makes it longer
+void jn_insert(int row, int col, const char *s, int n){
+	jn_ops++;
+	if (jn_last >= 0 && jn_buf.b[jn_last] == JN_INSERT && memchr(s, '\n', n) == NULL
+		&& memchr(s, '\r', n) == NULL){
+		int r, c, len;
+		memcpy(&r, jn_buf.b + jn_last + 1, 4);
+		memcpy(&c, jn_buf.b + jn_last + 5, 4);
+		memcpy(&len, jn_buf.b + jn_last + 9, 4);
+		char *text = jn_buf.b + jn_last + 13;
+		if (r == row && c + len == col && !memchr(text, '\n', len) && !memchr(text, '\r', len)){
+			len += n;
+			memcpy(jn_buf.b + jn_last + 9, &len, 4);
+			ab_append(&jn_buf, s, n);
+			return;
+		}
+	}
+	jn_last = jn_buf.len;
+	jn_rec(&jn_buf, JN_INSERT, row, col, n);
+	ab_append(&jn_buf, s, n);
+}
+
+// n bytes forward from row col went away, a run of backspaces or DELs is one record
+void jn_delete(int row, int col, int n){
+	jn_ops++;
+	if (jn_last >= 0 && jn_buf.b[jn_last] == JN_DELETE){
+		int r, c, len;
+		memcpy(&r, jn_buf.b + jn_last + 1, 4);
+		memcpy(&c, jn_buf.b + jn_last + 5, 4);
+		memcpy(&len, jn_buf.b + jn_last + 9, 4);
+		if (r == row && (c == col || col + n == c)){ // DEL in place, or backspace right before it
+			len += n;
+			memcpy(jn_buf.b + jn_last + 5, &col, 4);
+			memcpy(jn_buf.b + jn_last + 9, &len, 4);
+			return;
+		}
+	}
+	jn_last = jn_buf.len;
+	jn_rec(&jn_buf, JN_DELETE, row, col, n);
+}
+
+// the whole buffer as a snapshot: a run of untouched lines that still follow each other in
+// file_map is one JN_COPY, every other line a JN_TEXT. Goes to a temp file renamed over the old one,
+// unless it would not be smaller than the records it replaces. Returns 1 if it replaced them
+static int jn_snapshot(){
+	load_wait(INT_MAX);
+	struct ABUF snap = {NULL, 0, 0};
+	jn_header(&snap);
+	ab_append(&snap, (char []){JN_SNAP}, 1);
+
+	int off;
+	struct NODE *leaf = leaf_at(doc->buffer, 0, &off);
+	while (leaf != NULL){
+		if (off == leaf->n){
+			leaf = leaf->next;
+			off = 0;
+			continue;
+		}
+		struct LINE *line = &leaf->lines[off++];
+		if (line_in_map(line) && !line->dirty){
+			char *run_end = line->str + line->len;
+			while (leaf != NULL){ // same runs as buffer_to_file()
+				if (off == leaf->n){
+					leaf = leaf->next;
+					off = 0;
+					continue;
+				}
+				struct LINE *next = &leaf->lines[off];
+				if (!line_in_map(next) || next->dirty || next->str != run_end + 1 || *run_end != '\n')
+					break;
+				run_end = next->str + next->len;
+				off++;
+			}
+			long long pos[2] = {line->str - doc->file_map, run_end - line->str};
+			ab_append(&snap, (char []){JN_COPY}, 1);
+			ab_append(&snap, (char *)pos, 16);
+			continue;
+		}
+		ab_append(&snap, (char []){JN_TEXT}, 1);
+		ab_append(&snap, (char *)&line->len, 4);
+		ab_append(&snap, line->str, line->gap);
+		ab_append(&snap, line_tail(line), line->len - line->gap);
+	}
+	ab_append(&snap, (char []){JN_SNAP_END}, 1);
+	jn_snap = snap.len;
+	if (snap.len >= jn_size + jn_buf.len){ // mostly new text, the records are as small as it gets
+		free(snap.b);
+		return 0;
+	}
+
+	char tmp_name[4096 + 8];
+	snprintf(tmp_name, sizeof(tmp_name), "%s-XXXXXX", jn_name);
+	int fd = mkstemp(tmp_name);
+	if (fd < 0){
+		free(snap.b);
+		return 0; // keep appending to the old one
+	}
+	if (write(fd, snap.b, snap.len) != snap.len || fsync(fd) < 0 || rename(tmp_name, jn_name) < 0){
+		unlink(tmp_name);
+		close(fd);
+		free(snap.b);
+		return 0;
+	}
+	if (jn_fd >= 0) close(jn_fd);
+	jn_fd = fd;
+	jn_size = snap.len;
+	free(snap.b);
+	return 1;
+}
+
+// records to disk. Big enough, the swap file gets replaced by a snapshot that has them in it
+void jn_flush(){
+	if (jn_buf.len == 0) return;
+	if (jn_fd < 0){ // first edit: start the swap file
+		jn_fd = open(jn_name, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0600);
+		if (jn_fd < 0) return; // no swap file then, saving still works
+		struct ABUF head = {NULL, 0, 0};
+		jn_header(&head);
+		if (write(jn_fd, head.b, head.len) != head.len){}
+		free(head.b);
+		jn_size = jn_snap = JN_HEAD;
+	}
+	long long grown = jn_size + jn_buf.len;
+	if (!(grown > JN_COMPACT && grown > 4 * jn_snap && jn_snapshot())){
+		char *p = jn_buf.b;
+		int left = jn_buf.len;
+		while (left > 0){
+			ssize_t n = write(jn_fd, p, left);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break; // disk full: the records stay lost, the buffer itself is fine
+			p += n;
+			left -= n;
+		}
+		jn_size += jn_buf.len - left;
+		fsync(jn_fd);
+	}
+	jn_buf.len = 0;
+	jn_last = -1;
+}
+
+static void jn_flush_timer(void *arg){
+	jn_flush();
+}
+
+// the file got saved, nothing left to recover
+void jn_remove(){
+	if (jn_fd >= 0) close(jn_fd);
+	jn_fd = -1;
+	jn_buf.len = 0;
+	jn_last = -1;
+	unlink(jn_name);
+}
+
+// replay <filename>.grid-swp onto the buffer file_to_buffer() just loaded, if there is one.
+// Returns -1 with the reason on the status line if the swap file can't be used, the buffer is
+// thrown away then
+int jn_recover(char *filename){
+	struct stat st;
+	const char *why = NULL;
+	if (snprintf(jn_name, sizeof(jn_name), "%s.grid-swp", filename) >= sizeof(jn_name)){
+		snprintf(status_line, sizeof(status_line), "File name too long");
+		return -1;
+	}
+	if (stat(filename, &st) == 0){
+		jn_file_size = st.st_size;
+		jn_file_mtime = st.st_mtime;
+	}
+
+	int fd = open(jn_name, O_RDONLY);
+	if (fd < 0) return 0;
+	load_wait(INT_MAX); // records may be anywhere in the file
+	char *log = NULL;
+	long long got = 0;
+	if (fstat(fd, &st) < 0) why = "fstat error on the swap file";
+	else{
+		log = malloc(st.st_size + 1);
+		if (log == NULL) die("malloc error");
+	}
+	while (why == NULL && got < st.st_size){
+		ssize_t n = read(fd, log + got, st.st_size - got);
+		if (n <= 0) why = "Error reading swap file";
+		else got += n;
+	}
+	close(fd);
+	if (why == NULL && (got < JN_HEAD || memcmp(log, JN_MAGIC, 8) != 0))
+		why = "Swap file is not ours, move it away first";
+	if (why == NULL && (memcmp(log + 8, &jn_file_size, 8) != 0 || memcmp(log + 16, &jn_file_mtime, 8) != 0))
+		why = "The file changed after its swap file was written, move the swap file away first";
+	if (why != NULL){
+		snprintf(status_line, sizeof(status_line), "%s", why);
+		free(log);
+		return -1;
+	}
+
+	char *p = log + JN_HEAD;
+	char *end = log + got;
+	char *base = p; // where the records after the last snapshot start
+	struct BUILD snap = {NULL, 0, 0, 0};
+	int in_snap = 0;
+	while (p < end){ // a record cut short by a crash ends the replay
+		int row, col, len;
+		if (*p == JN_INSERT || *p == JN_DELETE){
+			if (end - p < 13) break;
+			memcpy(&row, p + 1, 4);
+			memcpy(&col, p + 5, 4);
+			memcpy(&len, p + 9, 4);
+			if (len < 0 || (*p == JN_INSERT && end - p - 13 < len)) break;
+		}
+		if (*p == JN_INSERT || *p == JN_DELETE){
+			if (in_snap || row < 0 || row >= doc->buf_line_no || col < 0) break;
+			if (col > line_at(doc->buffer, row)->len) break;
+			struct CURPOR at;
+			if (*p == JN_INSERT) insert_text(row, col, p + 13, len, &at);
+			else delete_text(row, col, len);
+			p += *p == JN_INSERT ? 13 + len : 13;
+		}
+		else if (*p == JN_SNAP){
+			if (in_snap) break;
+			in_snap = 1;
+			p++;
+		}
+		else if (*p == JN_COPY){
+			long long pos[2];
+			if (!in_snap || end - p < 17) break;
+			memcpy(pos, p + 1, 16);
+			if (pos[0] < 0 || pos[1] < 0 || pos[0] + pos[1] > doc->file_map_size) break;
+			char *s = doc->file_map + pos[0];
+			char *stop = s + pos[1];
+			for (;;){ // the lines of the run, all still pieces of file_map
+				char *nl = s < stop ? memchr(s, '\n', stop - s) : NULL;
+				if (nl == NULL) nl = stop;
+				struct LINE *line = build_line(&snap);
+				line->len = line->gap = nl - s;
+				line->str = s;
+				if (nl == stop) break;
+				s = nl + 1;
+			}
+			p += 17;
+		}
+		else if (*p == JN_TEXT){
+			if (!in_snap || end - p < 5) break;
+			memcpy(&len, p + 1, 4);
+			if (len < 0 || end - p - 5 < len) break;
+			struct LINE *line = build_line(&snap);
+			line_grow(line, len);
+			memcpy(line->str, p + 5, len);
+			line->len = line->gap = len;
+			line_dirty(line);
+			p += 5 + len;
+		}
+		else if (*p == JN_SNAP_END){
+			if (!in_snap) break;
+			if (snap.rows == 0) build_line(&snap); // there is always a line
+			tree_free(doc->buffer);
+			doc->buffer = tree_build(snap.leaves, snap.n);
+			doc->file_rows = doc->buf_line_no = snap.rows;
+			memset(&snap, 0, sizeof(snap));
+			in_snap = 0;
+			base = ++p;
+		}
+		else break;
+		jn_replayed++;
+	}
+	if (in_snap){
+		if (snap.n > 0) tree_drop(tree_build(snap.leaves, snap.n));
+		else free(snap.leaves);
+		snprintf(status_line, sizeof(status_line), "Swap file ends inside a snapshot");
+		free(log);
+		return -1;
+	}
+
+	// keep going in the same swap file, minus whatever was cut short
+	jn_size = p - log;
+	jn_snap = base - log;
+	free(log);
+	jn_fd = open(jn_name, O_WRONLY | O_APPEND);
+	if (jn_fd >= 0 && jn_size < got && ftruncate(jn_fd, jn_size) < 0){
+		close(jn_fd);
+		jn_fd = -1;
+	}
+	return 0;
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| UNDO - log of edits, redo on top |------------------------------*/
+/* the edits handle_input() makes out of add_cols(), del_cols(), split_line() and join_lines() are
+ * logged as the same two ops the journal uses, with the text that went in or out:
+ * [type][row][col][len][len bytes][size]. size at the end lets undo walk the log backwards, what
+ * is past undo_top is redo. Typing, backspaces and DELs in a row grow the last record, one record is
+ * one undo step. Undoing a paste deletes its bytes again, nothing else gets copied. The log keeps
+ * the newest undo_limit bytes (GRID_UNDO in the environment), older edits fall off the front.
+ * Records made between undo_group_begin() and undo_group_end() are undone as one step */
+#define UNDO_MAX (16 << 20)
+#define UNDO_HEAD 13
+#define UNDO_JOINED 0x80 // on the type byte: this record goes with the one before it
+
+long undo_limit = UNDO_MAX;
+static struct ABUF undo_log = {NULL, 0, 0};
+static int undo_top = 0; // end of what can be undone, the rest up to undo_log.len can be redone
+static int undo_sealed = 1; // the cursor moved, the next edit starts a record of its own
+static int undo_grouping = 0; // 1 inside a group, 2 once its first record is in, 3 if it outgrew the log
+
+// a record's fields, rec points at its type byte
+static void undo_fields(char *rec, int *row, int *col, int *len){
+	memcpy(row, rec + 1, 4);
+	memcpy(col, rec + 5, 4);
+	memcpy(len, rec + 9, 4);
+}
+
+// start a new record at the end, whatever was undone can't be redone anymore after this
+static void undo_begin(int type, int row, int col){
+	undo_log.len = undo_top;
+	jn_rec(&undo_log, undo_grouping == 2 ? type | UNDO_JOINED : type, row, col, 0);
+	if (undo_grouping) undo_grouping = 2;
+}
+
+// everything logged until undo_group_end() is one undo step
+void undo_group_begin(){
+	undo_sealed = 1; // and none of it grows a record from before
+	undo_grouping = 1;
+}
+
+void undo_group_end(){
+	undo_sealed = 1;
+	undo_grouping = 0;
+}
+
+// close the record: trailer on, then drop the oldest records once over the limit. They go a
+// quarter of the limit at a time, so the memmove is paid for by that many bytes of editing
+static void undo_end(){
+	int size = undo_log.len + 4 - undo_top;
+	ab_append(&undo_log, (char *)&size, 4);
+	undo_top = undo_log.len;
+	undo_sealed = 0;
+	if (undo_log.len <= undo_limit) return;
+
+	int cut = 0;
+	while (cut < undo_log.len && undo_log.len - cut > undo_limit - undo_limit / 4){
+		int row, col, len;
+		undo_fields(undo_log.b + cut, &row, &col, &len);
+		cut += UNDO_HEAD + len + 4;
+		while (cut < undo_log.len && (undo_log.b[cut] & UNDO_JOINED)){ // no half groups
+			undo_fields(undo_log.b + cut, &row, &col, &len);
+			cut += UNDO_HEAD + len + 4;
+		}
+	}
+	memmove(undo_log.b, undo_log.b + cut, undo_log.len - cut);
+	undo_log.len -= cut;
+	undo_top = undo_log.len;
+	if (undo_grouping && undo_log.len == 0) undo_grouping = 3; // the group can't be undone whole
+}
+
+// the last record, if there is one and it can still grow: nothing undone, the cursor didn't move
+static char *undo_last(int type){
+	if (undo_sealed || undo_top == 0 || undo_top != undo_log.len) return NULL;
+	int size;
+	memcpy(&size, undo_log.b + undo_top - 4, 4);
+	char *rec = undo_log.b + undo_top - size;
+	return rec[0] == type ? rec : NULL;
+}
+
+// s[0, n) is going in at row col. Stored with line breaks as '\n', the way insert_text() reads them
+void undo_insert(int row, int col, const char *s, int n){
+	if (undo_grouping == 3) return;
+	char *rec = undo_last(JN_INSERT);
+	int r, c, len;
+	if (rec != NULL){
+		undo_fields(rec, &r, &c, &len);
+		if (r != row || c + len != col || memchr(rec + UNDO_HEAD, '\n', len)
+			|| memchr(s, '\n', n) || memchr(s, '\r', n)) rec = NULL;
+	}
+	if (rec != NULL){ // typing on: take the trailer off and grow the record
+		undo_log.len -= 4;
+		undo_top = rec - undo_log.b;
+	}
+	else undo_begin(JN_INSERT, row, col);
+
+	for (int i = 0; i < n; i++){
+		char ch = s[i];
+		if (ch == '\r'){ // "\r\n" and a lone '\r' are both one line break
+			if (i + 1 < n && s[i + 1] == '\n') i++;
+			ch = '\n';
+		}
+		ab_append(&undo_log, &ch, 1);
+	}
+	rec = undo_log.b + undo_top;
+	len = undo_log.len - undo_top - UNDO_HEAD;
+	memcpy(rec + 9, &len, 4);
+	undo_end();
+}
+
+// the text delete_text(row, col, n) would take out, line ends as '\n'
+static void text_copy(int row, int col, int n, struct ABUF *out){
+	while (n > 0 && row < doc->buf_line_no){
+		struct LINE *obj = line_at(doc->buffer, row);
+		int k = obj->len - col < n ? obj->len - col : n;
+		if (k > 0){ // both sides of the gap, as much of each as is in [col, col + k)
+			int a = obj->gap < col + k ? obj->gap : col + k;
+			if (col < a) ab_append(out, obj->str + col, a - col);
+			int b = obj->gap > col ? obj->gap : col;
+			if (b < col + k) ab_append(out, line_tail(obj) + b - obj->gap, col + k - b);
+			n -= k;
+		}
+		if (n == 0 || row + 1 == doc->buf_line_no) break;
+		ab_append(out, "\n", 1);
+		n--;
+		row++;
+		col = 0;
+	}
+}
+
+// n bytes are about to go from row col forward, copy them out of the buffer first
+void undo_delete(int row, int col, int n){
+	if (undo_grouping == 3) return;
+	struct ABUF text = {NULL, 0, 0};
+	text_copy(row, col, n, &text);
+	if (text.len == 0) return;
+
+	char *rec = undo_last(JN_DELETE);
+	int r, c, len;
+	int front = 0; // backspace: these bytes were before the ones the record has
+	if (rec != NULL){
+		undo_fields(rec, &r, &c, &len);
+		if (r == row && c == col) front = 0; // DEL, same spot again
+		else if (r == row && col + text.len == c && !memchr(text.b, '\n', text.len)) front = 1;
+		else rec = NULL;
+	}
+	if (rec != NULL){
+		undo_log.len -= 4;
+		undo_top = rec - undo_log.b;
+	}
+	else undo_begin(JN_DELETE, row, col);
+
+	ab_append(&undo_log, text.b, text.len); // room at the end, moved to the front for a backspace
+	rec = undo_log.b + undo_top;
+	len = undo_log.len - undo_top - UNDO_HEAD;
+	if (front){
+		memmove(rec + UNDO_HEAD + text.len, rec + UNDO_HEAD, len - text.len);
+		memcpy(rec + UNDO_HEAD, text.b, text.len);
+		memcpy(rec + 5, &col, 4);
+	}
+	memcpy(rec + 9, &len, 4);
+	undo_end();
+	free(text.b);
+}
+
+// one record, or group of them, backwards (redo: forwards), done through insert_text() and
+// delete_text() and journaled like any edit. Returns 0 with nothing left to undo, else the cursor
+// goes to *at
+int undo_step(int redo, struct CURPOR *at){
+	if (redo ? undo_top == undo_log.len : undo_top == 0) return 0;
+	for (;;){
+		int size;
+		char *rec;
+		if (redo) rec = undo_log.b + undo_top;
+		else {
+			memcpy(&size, undo_log.b + undo_top - 4, 4);
+			rec = undo_log.b + undo_top - size;
+		}
+		int row, col, len;
+		undo_fields(rec, &row, &col, &len);
+		char *text = rec + UNDO_HEAD;
+
+		at->row = row;
+		at->col = col;
+		if ((((unsigned char) rec[0] & ~UNDO_JOINED) == JN_INSERT) == redo){ // put the text (back) in
+			jn_insert(row, col, text, len);
+			insert_text(row, col, text, len, at);
+		}
+		else {
+			jn_delete(row, col, len);
+			delete_text(row, col, len);
+		}
+		undo_top = redo ? undo_top + UNDO_HEAD + len + 4 : rec - undo_log.b;
+		if (redo ? undo_top == undo_log.len || !(undo_log.b[undo_top] & UNDO_JOINED)
+			: undo_top == 0 || !(rec[0] & UNDO_JOINED)) break;
+	}
+	undo_sealed = 1;
+	return 1;
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| SEARCH - find, find next, search as you type |------------------*/
+/* the scan works on the bytes where they are: inside a leaf, lines that still sit next to each
+ * other in file_map are one block, so most of a big file is searched in leaf sized pieces of the
+ * map with no copying. The block scan compares the first and last byte of the pattern 16 or 32
+ * positions at a time (SSE2/AVX2, picked once at runtime) and memcmp()s only where both hit.
+ * Search as you type keeps the match of every prefix of the pattern: a longer pattern can only
+ * match at or after where the shorter one did, so a typed char resumes from there and a
+ * backspace just goes back to the match it had */
+#define SEARCH_MAX 128
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static const char *find_sse2(const char *s, size_t n, const char *p, size_t m){
+	__m128i first = _mm_set1_epi8(p[0]);
+	__m128i last = _mm_set1_epi8(p[m - 1]);
+	size_t i = 0;
+	for (; i + m - 1 + 16 <= n; i += 16){
+		__m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + i + m - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		for (; mask != 0; mask &= mask - 1){
+			int k = __builtin_ctz(mask);
+			if (memcmp(s + i + k + 1, p + 1, m - 2) == 0) return s + i + k;
+		}
+	}
+	return memmem(s + i, n - i, p, m); // less than a block left
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *s, size_t n, const char *p, size_t m){
+	__m256i first = _mm256_set1_epi8(p[0]);
+	__m256i last = _mm256_set1_epi8(p[m - 1]);
+	size_t i = 0;
+	for (; i + m - 1 + 32 <= n; i += 32){
+		__m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(s + i + m - 1));
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+			_mm256_cmpeq_epi8(b, last)));
+		for (; mask != 0; mask &= mask - 1){
+			int k = __builtin_ctz(mask);
+			if (memcmp(s + i + k + 1, p + 1, m - 2) == 0) return s + i + k;
+		}
+	}
+	return find_sse2(s + i, n - i, p, m);
+}
+#endif
+
+static const char *find_scalar(const char *s, size_t n, const char *p, size_t m){
+	return memmem(s, n, p, m);
+}
+
+static const char *(*find_block)(const char *s, size_t n, const char *p, size_t m) = NULL;
+
+// first p[0, m) in s[0, n), NULL if there is none
+static const char *find_in(const char *s, size_t n, const char *p, size_t m){
+	if (n < m) return NULL;
+	if (m == 1) return memchr(s, p[0], n);
+	if (find_block == NULL){ // what this cpu can do, once
+		find_block = find_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2")) find_block = find_sse2;
+		if (__builtin_cpu_supports("avx2")) find_block = find_avx2;
+#endif
+	}
+	return find_block(s, n, p, m);
+}
+
+static int pos_before(int row, int col, int row2, int col2){
+	return row < row2 || (row == row2 && col < col2);
+}
+
+// first match at or after row col and before stop_row stop_col, into *hit. The pattern has no '\n'
+// so a match found in a block of map lines never crosses from one line into the next
+static int search_from(const char *pat, int m, int row, int col, int stop_row, int stop_col,
+	struct CURPOR *hit){
+	if (row >= doc->buf_line_no) return 0;
+	int off;
+	struct NODE *leaf = leaf_at(doc->buffer, row, &off);
+	for (; leaf != NULL && row <= stop_row; leaf = leaf->next, off = 0){
+		while (off < leaf->n && row <= stop_row){
+			struct LINE *line = &leaf->lines[off];
+			int from = col < line->len ? col : line->len;
+			col = 0;
+			if (!line_in_map(line)){
+				line_move_gap(line, line->len); // text in one piece, the content stays the same
+				const char *p = find_in(line->str + from, line->len - from, pat, m);
+				if (p != NULL){
+					hit->row = row;
+					hit->col = p - line->str;
+					return pos_before(hit->row, hit->col, stop_row, stop_col);
+				}
+				off++;
+				row++;
+				continue;
+			}
+
+			int end = off + 1; // the block: map lines of this leaf that follow each other
+			char *block_end = line->str + line->len;
+			while (end < leaf->n && line_in_map(&leaf->lines[end]) && leaf->lines[end].str == block_end + 1
+				&& *block_end == '\n' && row + end - off <= stop_row){
+				block_end = leaf->lines[end].str + leaf->lines[end].len;
+				end++;
+			}
+			const char *p = find_in(line->str + from, block_end - line->str - from, pat, m);
+			if (p != NULL){
+				int k = off;
+				while (k + 1 < end && leaf->lines[k + 1].str <= p) k++; // the line it is in
+				hit->row = row + k - off;
+				hit->col = p - leaf->lines[k].str;
+				return pos_before(hit->row, hit->col, stop_row, stop_col);
+			}
+			row += end - off;
+			off = end;
+		}
+	}
+	return 0;
+}
+
+// first match going forward from row col, around the end back to the top, up to (not past) the
+// stop position. Starting after the stop position means the whole wrapped range
+static int search_wrap(const char *pat, int m, int row, int col, int stop_row, int stop_col,
+	struct CURPOR *hit){
+	if (m == 0) return 0;
+	load_wait(INT_MAX);
+	if (!pos_before(row, col, stop_row, stop_col)){
+		if (search_from(pat, m, row, col, doc->buf_line_no, 0, hit)) return 1;
+		row = col = 0;
+	}
+	return search_from(pat, m, row, col, stop_row, stop_col, hit);
+}
+
+static int search_active = 0; // the bottom row is the search prompt, keys go to search_key()
+static char search_pat[SEARCH_MAX + 1];
+static int search_len = 0;
+static char last_pat[SEARCH_MAX + 1]; // what CTRL-N looks for
+static struct CURPOR search_back; // cursor before the search, ESC goes back there
+// match of search_pat[0, k), row -1 if there is none, -2 if not looked for. [0] is the origin
+static struct CURPOR prefix_hit[SEARCH_MAX + 1];
+
+static void search_status(int found){
+	snprintf(status_line, sizeof(status_line), "search: %s%s", search_pat, found ? "" : "  (not found)");
+}
+
+// search_pat grew from prefix length k: resume at the match that prefix had
+static void search_grow(int k){
+	struct CURPOR *prev = prefix_hit[k].row == -2 ? &prefix_hit[0] : &prefix_hit[k];
+	struct CURPOR *hit = &prefix_hit[search_len];
+	if (prev->row < 0 || !search_wrap(search_pat, search_len, prev->row, prev->col,
+		prefix_hit[0].row, prefix_hit[0].col, hit)) hit->row = -1;
+	for (int i = k + 1; i < search_len; i++) prefix_hit[i].row = -2; // pasted in one go
+}
+
+// show the match for the current pattern, or the cursor where the search started
+static void search_show(){
+	struct CURPOR *hit = &prefix_hit[search_len];
+	if (hit->row == -2) search_grow(0);
+	int found = search_len == 0 || hit->row >= 0;
+	win->cur = search_len > 0 && found ? *hit : search_back;
+	search_status(found);
+}
+
+// next match after the cursor, around the end if it has to. The prompt's prefixes all match here
+static int search_next(const char *pat){
+	int m = strlen(pat);
+	struct CURPOR hit;
+	if (!search_wrap(pat, m, win->cur.row, win->cur.col + 1, win->cur.row, win->cur.col + 1, &hit)) return 0;
+	win->cur = hit;
+	return 1;
+}
+
+// CTRL-F: the prompt takes over the bottom row
+void search_start(){
+	search_active = 1;
+	search_len = 0;
+	search_pat[0] = '\0';
+	search_back = prefix_hit[0] = win->cur;
+	search_status(1);
+}
+
+// keys while the prompt is up. Returns 0 if the key ends the search and is left for handle_input()
+int search_key(int c){
+	switch(c){
+		case 033: // ESC, back to where it all started
+			win->cur = search_back;
+			// fall through
+		case '\r':
+		case '\n':
+			search_active = 0;
+			status_line[0] = '\0';
+			if (search_len > 0) strcpy(last_pat, search_pat);
+			return 1;
+		case 127:
+		case 8:
+			if (search_len > 0) search_pat[--search_len] = '\0';
+			search_show(); // the shorter prefix still has its match
+			return 1;
+		case 006: // CTRL-F again, or CTRL-N
+		case 016:{
+			if (search_len == 0){ // go on with the last search
+				strcpy(search_pat, last_pat);
+				search_len = strlen(search_pat);
+			}
+			int found = search_len > 0 && search_next(search_pat);
+			for (int i = 0; i <= search_len; i++){ // every prefix matches here, if it did
+				prefix_hit[i] = win->cur;
+				if (!found && i > 0) prefix_hit[i].row = i < search_len ? -2 : -1;
+			}
+			search_show();
+			return 1;
+		}
+		case KEY_PASTE:
+		default:{
+			int k = search_len;
+			if (c == KEY_PASTE){
+				for (int i = 0; i < paste_buf.len && search_len < SEARCH_MAX; i++)
+					if ((unsigned char) paste_buf.b[i] >= 32) search_pat[search_len++] = paste_buf.b[i];
+			}
+			else if (c >= 32 && c < 256 && c != 127){
+				if (search_len < SEARCH_MAX) search_pat[search_len++] = c;
+			}
+			else { // anything else ends the search where it is and does what it always does
+				search_active = 0;
+				status_line[0] = '\0';
+				if (search_len > 0) strcpy(last_pat, search_pat);
+				return 0;
+			}
+			search_pat[search_len] = '\0';
+			if (search_len > k) search_grow(k);
+			search_show();
+			return 1;
+		}
+	}
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| REGEX - replace all on a thread pool |--------------------------*/
+/* CTRL-R asks for a POSIX extended regex, then for what to put instead (\0 to \9 are the match and
+ * its groups). CTRL-N on either prompt goes to the next match. Replace-all cuts the buffer into
+ * REGEX_CHUNK row chunks that the pool's workers take one at a time. A worker only reads the
+ * tree and writes the new text of every line it changes into its chunk's own list. Once all chunks
+ * are in, the main thread swaps those lines in one pass, as one undo step, and the screen is
+ * redrawn once. The tree isn't touched while workers read it: the main thread waits in pool_run() */
+#define POOL_MAX 16
+#define REGEX_CHUNK 8192 // rows per chunk
+#define REGEX_GROUPS 10
+
+static pthread_t pool[POOL_MAX];
+static int pool_size = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static void (*pool_fn)(int chunk, int worker);
+static int pool_next = 0; // next chunk to hand out
+static int pool_chunks = 0;
+static int pool_left = 0; // chunks not finished yet
+
+static void *pool_worker(void *arg){
+	int id = (long) arg;
+	pthread_mutex_lock(&pool_lock);
+	for (;;){
+		while (pool_next >= pool_chunks) pthread_cond_wait(&pool_wake, &pool_lock);
+		int chunk = pool_next++;
+		pthread_mutex_unlock(&pool_lock);
+		pool_fn(chunk, id);
+		pthread_mutex_lock(&pool_lock);
+		if (--pool_left == 0) pthread_cond_signal(&pool_done);
+	}
+	return NULL;
+}
+
+// the workers, one per cpu. Started the first time they are needed, they sleep in between
+static void pool_start(){
+	if (pool_size > 0) return;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int want = cpus < 1 ? 1 : cpus > POOL_MAX ? POOL_MAX : cpus;
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old); // signals stay with the main thread
+	while (pool_size < want && pthread_create(&pool[pool_size], NULL, pool_worker, (void *)(long) pool_size) == 0)
+		pool_size++;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (pool_size == 0) die("pthread_create error");
+}
+
+// fn(chunk, worker) for every chunk in [0, n), spread over the pool, back when all are done
+static void pool_run(int n, void (*fn)(int chunk, int worker)){
+	pool_start();
+	pthread_mutex_lock(&pool_lock);
+	pool_fn = fn;
+	pool_next = 0;
+	pool_chunks = pool_left = n;
+	pthread_cond_broadcast(&pool_wake);
+	while (pool_left > 0) pthread_cond_wait(&pool_done, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+static regex_t regex_re[POOL_MAX + 1]; // one per worker, glibc regexec() locks a shared one, and ours
+static int regex_ready = 0; // how many are compiled
+static char regex_pat[SEARCH_MAX + 1];
+static char regex_with[SEARCH_MAX + 1];
+static int regex_active = 0; // 1: the pattern prompt is up, 2: the replacement prompt
+static struct ABUF regex_out[POOL_MAX]; // a worker's copy of a line that has a gap in it
+static struct ABUF *regex_lines = NULL; // per chunk: [row][len][text] for every line it changes
+static long *regex_count = NULL; // per chunk: replacements made
+
+// compile regex_pat for everyone, 0 if it doesn't compile
+static int regex_compile(){
+	pool_start();
+	while (regex_ready > 0) regfree(&regex_re[--regex_ready]);
+	for (; regex_ready <= pool_size; regex_ready++) // [pool_size] is the main thread's
+		if (regcomp(&regex_re[regex_ready], regex_pat, REG_EXTENDED) != 0) return 0;
+	return 1;
+}
+
+// next match in s[from, n), REG_STARTEND so map lines don't need a '\0' after them
+static int regex_match(regex_t *re, const char *s, int from, int n, regmatch_t *m){
+	m[0].rm_so = from;
+	m[0].rm_eo = n;
+	return regexec(re, s, REGEX_GROUPS, m, REG_STARTEND | (from > 0 ? REG_NOTBOL : 0)) == 0;
+}
+
+static void regex_chunk(int chunk, int worker){
+	regex_t *re = &regex_re[worker];
+	struct ABUF *out = &regex_lines[chunk];
+	struct ABUF line_new = {NULL, 0, 0};
+	int row = chunk * REGEX_CHUNK;
+	int stop = row + REGEX_CHUNK < doc->buf_line_no ? row + REGEX_CHUNK : doc->buf_line_no;
+	int off;
+	struct NODE *leaf = leaf_at(doc->buffer, row, &off);
+	for (; row < stop; row++, off++){
+		if (off == leaf->n){
+			leaf = leaf->next;
+			off = 0;
+		}
+		struct LINE *line = &leaf->lines[off];
+		const char *s = line_text(line, &regex_out[worker]);
+		regmatch_t m[REGEX_GROUPS];
+		long counted = regex_count[chunk];
+		int from = 0;
+		int after = -1; // where the last non-empty match ended, no empty match right there (like sed)
+		line_new.len = 0;
+		while (from <= line->len && regex_match(re, s, from, line->len, m)){
+			ab_append(&line_new, s + from, m[0].rm_so - from);
+			if (m[0].rm_so == m[0].rm_eo && m[0].rm_so == after){
+				if (m[0].rm_so < line->len) ab_append(&line_new, s + m[0].rm_so, 1);
+				from = m[0].rm_so + 1;
+				after = -1;
+				continue;
+			}
+			for (const char *w = regex_with; *w; w++){ // the replacement, \\N is group N
+				if (w[0] == '\\' && w[1] >= '0' && w[1] <= '9'){
+					regmatch_t *g = &m[*++w - '0'];
+					if (g->rm_so >= 0) ab_append(&line_new, s + g->rm_so, g->rm_eo - g->rm_so);
+				}
+				else if (w[0] == '\\' && w[1] == '\\') ab_append(&line_new, ++w, 1);
+				else ab_append(&line_new, w, 1);
+			}
+			regex_count[chunk]++;
+			from = after = m[0].rm_eo;
+			if (m[0].rm_eo == m[0].rm_so){ // empty match, step over a char so it ends
+				if (from < line->len) ab_append(&line_new, s + from, 1);
+				from++;
+			}
+		}
+		if (regex_count[chunk] == counted) continue; // no match, line stays as it is
+		if (from < line->len) ab_append(&line_new, s + from, line->len - from);
+		ab_append(out, (char *)&row, 4);
+		ab_append(out, (char *)&line_new.len, 4);
+		ab_append(out, line_new.b, line_new.len);
+	}
+	free(line_new.b);
+}
+
+// every match of regex_pat becomes regex_with, returns how many
+long regex_replace_all(){
+	if (!regex_compile()) return -1;
+	load_wait(INT_MAX);
+	int chunks = (doc->buf_line_no + REGEX_CHUNK - 1) / REGEX_CHUNK;
+	regex_lines = calloc(chunks, sizeof(struct ABUF));
+	regex_count = calloc(chunks, sizeof(long));
+	if (regex_lines == NULL || regex_count == NULL) die("calloc error");
+	pool_run(chunks, regex_chunk);
+
+	long total = 0;
+	undo_group_begin();
+	for (int c = 0; c < chunks; c++){ // one pass down the buffer, chunks are in row order
+		total += regex_count[c];
+		for (char *p = regex_lines[c].b; p < regex_lines[c].b + regex_lines[c].len; ){
+			int row, len;
+			memcpy(&row, p, 4);
+			memcpy(&len, p + 4, 4);
+			p += 8;
+			struct LINE *line = line_at(doc->buffer, row);
+			jn_delete(row, 0, line->len); // the same edit as a delete and an insert, for the logs
+			undo_delete(row, 0, line->len);
+			jn_insert(row, 0, p, len);
+			undo_insert(row, 0, p, len);
+			hl_edit(row);
+			line_set(line, p, len);
+			p += len;
+		}
+		free(regex_lines[c].b);
+	}
+	undo_group_end();
+	free(regex_lines);
+	free(regex_count);
+	regex_lines = NULL;
+	return total;
+}
+
+// next match after the cursor, wrapping around
+static int regex_next(){
+	if (!regex_compile()) return 0;
+	load_wait(INT_MAX);
+	regex_t *re = &regex_re[pool_size];
+	struct ABUF scratch = {NULL, 0, 0};
+	for (int i = 0; i <= doc->buf_line_no; i++){
+		int row = (win->cur.row + i) % doc->buf_line_no;
+		struct LINE *line = line_at(doc->buffer, row);
+		int from = i == 0 ? win->cur.col + 1 : 0;
+		regmatch_t m[REGEX_GROUPS];
+		if (i == doc->buf_line_no) from = 0; // back on the cursor's line, the part before it
+		if (from <= line->len && regex_match(re, line_text(line, &scratch), from, line->len, m)){
+			if (i == doc->buf_line_no && m[0].rm_so > win->cur.col) break;
+			win->cur.row = row;
+			win->cur.col = m[0].rm_so;
+			free(scratch.b);
+			return 1;
+		}
+	}
+	free(scratch.b);
+	return 0;
+}
+
+static void regex_status(){
+	if (regex_active == 1) snprintf(status_line, sizeof(status_line), "regex: %s", regex_pat);
+	else snprintf(status_line, sizeof(status_line), "replace /%s/ with: %s", regex_pat, regex_with);
+}
+
+// CTRL-R
+void regex_start(){
+	regex_active = 1;
+	regex_status();
+}
+
+// keys while a regex prompt is up, like search_key()
+int regex_key(int c){
+	char *text = regex_active == 1 ? regex_pat : regex_with;
+	int len = strlen(text);
+	switch(c){
+		case 033: // ESC
+			regex_active = 0;
+			status_line[0] = '\0';
+			return 1;
+		case '\r':
+		case '\n':
+			if (regex_active == 1){
+				regex_active = 2;
+				regex_status();
+				return 1;
+			}
+			regex_active = 0;
+			double start = now_ms();
+			long n = regex_replace_all();
+			if (n < 0) snprintf(status_line, sizeof(status_line), "bad regex: %s", regex_pat);
+			else snprintf(status_line, sizeof(status_line), "%ld replaced in %.0f ms", n, now_ms() - start);
+			if (win->cur.col > line_at(doc->buffer, win->cur.row)->len) win->cur.col = line_at(doc->buffer, win->cur.row)->len;
+			return 1;
+		case 127:
+		case 8:
+			if (len > 0) text[len - 1] = '\0';
+			regex_status();
+			return 1;
+		case 016: // CTRL-N
+			if (!regex_next()) snprintf(status_line, sizeof(status_line), "no match: %s", regex_pat);
+			else regex_status();
+			return 1;
+		case KEY_PASTE:
+			for (int i = 0; i < paste_buf.len && len < SEARCH_MAX; i++)
+				if ((unsigned char) paste_buf.b[i] >= 32) text[len++] = paste_buf.b[i];
+			text[len] = '\0';
+			regex_status();
+			return 1;
+		default:
+			if (c >= 32 && c < 256 && c != 127){
+				if (len < SEARCH_MAX) text[len++] = c;
+				text[len] = '\0';
+				regex_status();
+				return 1;
+			}
+			regex_active = 0; // anything else leaves the prompt and does what it always does
+			status_line[0] = '\0';
+			return 0;
+	}
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| HIGHLIGHT - C, JSON and logs, lexed as little as it can be |------*/
+/* every LINE keeps the state its lexer ended in (inside a C comment or not), so a line can be
+ * colored knowing only the line above. Rows above hl_valid have the right state, except the rows
+ * edits touched since the last frame, hl_from to hl_to. Before a frame those are lexed again, and
+ * the rows after them only for as long as their end state keeps coming out different: typing in
+ * a line lexes that line. Below hl_valid nothing is lexed until the screen gets near it, a jump far
+ * down is caught up in idle slices and drawn with a guess meanwhile. Only rows on screen are lexed
+ * for colors, everything else just for the state */
+#define HL_EAGER 4096 // rows lexed on the spot to reach the screen, more than that is idle work
+#define HL_COMMENT 1 // C: the line ends inside a comment
+
+struct PAINT{ // columns [from, to) of the line being lexed go to pens[0, to - from)
+	unsigned char *pens;
+	int from;
+	int to;
+};
+
+static struct ABUF hl_scratch = {NULL, 0, 0};
+
+// the edit at row changes its text, row gets lexed again before the next frame
+void hl_edit(int row){
+	if (row < doc->hl_from) doc->hl_from = row;
+	if (row > doc->hl_to) doc->hl_to = row;
+}
+
+// a row was added at row (delta 1) or taken out there (-1), what is known below moves along
+void hl_rows(int row, int delta){
+	if (doc->hl_valid > row) doc->hl_valid += delta;
+	if (doc->hl_to >= row) doc->hl_to += delta;
+	hl_edit(row > 0 ? row - 1 : 0); // the line it was split from, or joined to
+	hl_edit(row);
+}
+
+// out gets pen for columns [from, to) of the line, whatever of them it wants
+static void hl_paint(struct PAINT *out, int from, int to, int pen){
+	if (out == NULL) return;
+	if (from < out->from) from = out->from;
+	if (to > out->to) to = out->to;
+	if (from < to) memset(out->pens + from - out->from, pen, to - from);
+}
+
+static int is_digit(char c){
+	return c >= '0' && c <= '9';
+}
+
+static int is_word(char c){
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || is_digit(c) || c == '_';
+}
+
+// s[0, n) is one of words, a NULL ended list
+static int word_in(const char *s, int n, const char *const *words, int nocase){
+	for (; *words != NULL; words++){
+		if ((int) strlen(*words) != n) continue;
+		if (nocase ? strncasecmp(*words, s, n) == 0 : memcmp(*words, s, n) == 0) return 1;
+	}
+	return 0;
+}
+
+// past the quote that closes the one at s[i], n if the line ends first
+static int quoted_end(const char *s, int n, int i){
+	char quote = s[i];
+	for (i++; i < n; i++){
+		if (s[i] == '\\') i++;
+		else if (s[i] == quote) return i + 1;
+	}
+	return n;
+}
+
+// past a number starting at s[i]: digits, letters of hex and suffixes, '.', the sign of an exponent
+static int number_end(const char *s, int n, int i){
+	for (i++; i < n; i++){
+		if (is_word(s[i]) || s[i] == '.') continue;
+		if ((s[i] == '+' || s[i] == '-') && (s[i - 1] == 'e' || s[i - 1] == 'E')) continue;
+		break;
+	}
+	return i;
+}
+
+static const char *const c_keywords[] = {"auto", "break", "case", "const", "continue", "default", "do",
+	"else", "enum", "extern", "for", "goto", "if", "inline", "register", "restrict", "return", "sizeof",
+	"static", "struct", "switch", "typedef", "union", "volatile", "while", NULL};
+static const char *const c_types[] = {"char", "double", "float", "int", "long", "short", "signed",
+	"unsigned", "void", "bool", "size_t", "ssize_t", "FILE", NULL};
+
+// C: comments, strings, numbers, keywords, types and the word of a # directive
+static int lex_c(const char *s, int n, int state, struct PAINT *out){
+	hl_paint(out, 0, n, PEN_PLAIN);
+	int i = 0;
+	if (state == HL_COMMENT){
+		const char *end = memmem(s, n, "*/", 2);
+		if (end == NULL){
+			hl_paint(out, 0, n, PEN_COMMENT);
+			return HL_COMMENT;
+		}
+		i = end - s + 2;
+		hl_paint(out, 0, i, PEN_COMMENT);
+	}
+	int lead = i; // a '#' is a directive only as the first thing on the line
+	while (lead < n && (s[lead] == ' ' || s[lead] == '\t')) lead++;
+
+	while (i < n){
+		char c = s[i];
+		int j = i + 1;
+		if (c == '/' && j < n && s[j] == '/'){
+			hl_paint(out, i, n, PEN_COMMENT);
+			return 0;
+		}
+		if (c == '/' && j < n && s[j] == '*'){
+			const char *end = memmem(s + i + 2, n - i - 2, "*/", 2);
+			if (end == NULL){
+				hl_paint(out, i, n, PEN_COMMENT);
+				return HL_COMMENT;
+			}
+			j = end - s + 2;
+			hl_paint(out, i, j, PEN_COMMENT);
+		}
+		else if (c == '"' || c == '\''){
+			j = quoted_end(s, n, i);
+			hl_paint(out, i, j, PEN_STRING);
+		}
+		else if (is_digit(c) || (c == '.' && j < n && is_digit(s[j]))){
+			j = number_end(s, n, i);
+			hl_paint(out, i, j, PEN_NUMBER);
+		}
+		else if (is_word(c)){
+			while (j < n && is_word(s[j])) j++;
+			if (out != NULL && word_in(s + i, j - i, c_keywords, 0)) hl_paint(out, i, j, PEN_KEYWORD);
+			else if (out != NULL && word_in(s + i, j - i, c_types, 0)) hl_paint(out, i, j, PEN_TYPE);
+		}
+		else if (c == '#' && i == lead){
+			while (j < n && (s[j] == ' ' || s[j] == '\t')) j++;
+			while (j < n && is_word(s[j])) j++;
+			hl_paint(out, i, j, PEN_PREPROC);
+		}
+		i = j;
+	}
+	return 0;
+}
+
+static const char *const json_literals[] = {"true", "false", "null", NULL};
+
+// JSON: keys, strings, numbers and literals. A string can't go on past its line, no state
+static int lex_json(const char *s, int n, int state, struct PAINT *out){
+	if (out == NULL) return 0;
+	hl_paint(out, 0, n, PEN_PLAIN);
+	for (int i = 0; i < n; ){
+		char c = s[i];
+		int j = i + 1;
+		if (c == '"'){
+			j = quoted_end(s, n, i);
+			int k = j;
+			while (k < n && (s[k] == ' ' || s[k] == '\t')) k++;
+			hl_paint(out, i, j, k < n && s[k] == ':' ? PEN_KEY : PEN_STRING);
+		}
+		else if (is_digit(c) || (c == '-' && j < n && is_digit(s[j]))){
+			j = number_end(s, n, i);
+			hl_paint(out, i, j, PEN_NUMBER);
+		}
+		else if (is_word(c)){
+			while (j < n && is_word(s[j])) j++;
+			if (word_in(s + i, j - i, json_literals, 0)) hl_paint(out, i, j, PEN_NUMBER);
+		}
+		i = j;
+	}
+	return 0;
+}
+
+static const char *const log_errors[] = {"error", "err", "fatal", "crit", "critical", "panic", "severe",
+	"fail", "failed", NULL};
+static const char *const log_warns[] = {"warn", "warning", NULL};
+static const char *const log_infos[] = {"info", "notice", NULL};
+static const char *const log_debugs[] = {"debug", "trace", NULL};
+
+// is c part of a timestamp: digits and what dates and times get written with
+static int is_stamp(const char *s, int n, int i){
+	char c = s[i];
+	if (is_digit(c) || c == '-' || c == ':' || c == '.' || c == '/' || c == ',' || c == '+' || c == 'T' || c == 'Z')
+		return 1;
+	return c == ' ' && i + 1 < n && is_digit(s[i + 1]); // between the date and the time
+}
+
+// logs: the timestamp up front, level words in any case, quoted strings. Every line stands alone
+static int lex_log(const char *s, int n, int state, struct PAINT *out){
+	if (out == NULL) return 0;
+	hl_paint(out, 0, n, PEN_PLAIN);
+	int i = n > 0 && s[0] == '[' ? 1 : 0;
+	if (i < n && is_digit(s[i])){
+		while (i < n && is_stamp(s, n, i)) i++;
+		if (i < n && s[i] == ']') i++;
+		hl_paint(out, 0, i, PEN_TIME);
+	}
+	else i = 0;
+	while (i < n){
+		char c = s[i];
+		int j = i + 1;
+		if (c == '"'){
+			j = quoted_end(s, n, i);
+			hl_paint(out, i, j, PEN_STRING);
+		}
+		else if (is_word(c)){
+			while (j < n && is_word(s[j])) j++;
+			if (word_in(s + i, j - i, log_errors, 1)) hl_paint(out, i, j, PEN_ERROR);
+			else if (word_in(s + i, j - i, log_warns, 1)) hl_paint(out, i, j, PEN_WARN);
+			else if (word_in(s + i, j - i, log_infos, 1)) hl_paint(out, i, j, PEN_INFO);
+			else if (word_in(s + i, j - i, log_debugs, 1)) hl_paint(out, i, j, PEN_DEBUG);
+		}
+		i = j;
+	}
+	return 0;
+}
+
+// the lexer goes by the file name: C and its headers, JSON, logs (rotated ones too), else none
+void hl_pick(const char *name){
+	const char *base = strrchr(name, '/');
+	base = base != NULL ? base + 1 : name;
+	const char *dot = strrchr(base, '.');
+	if (dot == NULL) return;
+	if (!strcmp(dot, ".c") || !strcmp(dot, ".h") || !strcmp(dot, ".cc") || !strcmp(dot, ".cpp")
+		|| !strcmp(dot, ".hpp")) doc->hl_lex = lex_c;
+	else if (!strcmp(dot, ".json")) doc->hl_lex = lex_json;
+	else if (!strcmp(dot, ".log") || strstr(base, ".log.") != NULL) doc->hl_lex = lex_log;
+}
+
+// lex rows from row on, each from the state the one above ended in, and keep their end states.
+// Stops before row to, or after a row at or past stable that ends the way it did before, since
+// everything below it is still right then. Returns the row after the last one lexed
+static int hl_lex_rows(int row, int to, int stable){
+	if (to > doc->buf_line_no) to = doc->buf_line_no;
+	if (row >= to) return row;
+	int state = row > 0 ? line_at(doc->buffer, row - 1)->hl : 0;
+	int off;
+	struct NODE *leaf = leaf_at(doc->buffer, row, &off);
+	for (; leaf != NULL && row < to; leaf = leaf->next, off = 0){
+		for (; off < leaf->n && row < to; off++){
+			struct LINE *line = &leaf->lines[off];
+			int end = doc->hl_lex(line_text(line, &hl_scratch), line->len, state, NULL);
+			int same = end == line->hl;
+			line->hl = state = end;
+			row++;
+			if (same && row > stable) return row;
+		}
+	}
+	return row;
+}
+
+// idle work after a far jump: lex on toward what each window shows, redraw once it is there
+static int hl_idle(double until){
+	int more = 0;
+	for (struct WIN *w = wins; w != NULL; w = w->next){
+		struct WIN *was = win_use(w);
+		int limit = win->view.top + win->rows;
+		if (limit > doc->buf_line_no) limit = doc->buf_line_no;
+		if (doc->hl_lex != NULL){
+			if (doc->hl_from < doc->hl_valid) doc->hl_valid = doc->hl_from; // edits the next frame hasn't seen yet
+			while (doc->hl_valid < limit && now_ms() < until)
+				doc->hl_valid = hl_lex_rows(doc->hl_valid, doc->hl_valid + 1024, INT_MAX);
+			if (doc->hl_valid < limit) more = 1;
+		}
+		win_use(was);
+	}
+	if (more) return 1;
+	screen_stale = 1;
+	return 0;
+}
+
+// before a frame: lex the edited rows again, and the rows down to limit if that is near enough.
+// Returns the state row top starts in, plain as a guess while the idle work isn't there yet
+int hl_begin(int top, int limit){
+	if (doc->hl_lex == NULL) return 0;
+	if (limit > doc->buf_line_no) limit = doc->buf_line_no;
+	if (doc->hl_valid > doc->buf_line_no) doc->hl_valid = doc->buf_line_no;
+	if (doc->hl_from < doc->hl_valid){
+		int stop = doc->hl_valid < limit ? doc->hl_valid : limit;
+		int row = hl_lex_rows(doc->hl_from, stop, doc->hl_to + 1);
+		if (row >= stop) doc->hl_valid = row; // it didn't settle before it had to stop, below is unknown
+	}
+	doc->hl_from = INT_MAX;
+	doc->hl_to = -1;
+	if (doc->hl_valid < limit){
+		if (limit - doc->hl_valid <= HL_EAGER) doc->hl_valid = hl_lex_rows(doc->hl_valid, limit, INT_MAX);
+		else idle_add(hl_idle);
+	}
+	if (top > doc->hl_valid) return 0;
+	return top > 0 ? line_at(doc->buffer, top - 1)->hl : 0;
+}
+
+// pens for the columns [from, from + n) of line, lexed from state. Returns the state it ends in
+int hl_color(struct LINE *line, int state, unsigned char *pens, int from, int n){
+	if (doc->hl_lex == NULL){
+		memset(pens, PEN_PLAIN, n);
+		return 0;
+	}
+	struct PAINT out = {pens, from, from + n};
+	return doc->hl_lex(line_text(line, &hl_scratch), line->len, state, &out);
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| PAGER - grid -R, read only, no LINEs at all |-------------------*/
+/* for logs too big to load: the file is only mapped, and all that is kept besides is a sparse
+ * index, where every PAGER_MARK-th line starts. The index grows only as far as something asks
+ * (a goto, the end, a search hit), after that any line is at most PAGER_MARK memchr()s away.
+ * Paging walks from the top line with memchr()/memrchr(), so it costs one screen at any size.
+ * Pages a long scan faulted in are handed back, the screen is all that stays resident.
+ * The file is watched while it is open: when it grows, only the new bytes get mapped and the
+ * index counts on from where it stopped. Following (grid -F, or F) keeps the last page on
+ * screen, otherwise the frame diff only repaints rows the new lines show up on */
+#define PAGER_MARK 4096 // lines between two checkpoints of the index
+#define PAGER_KEEP (64 << 20) // bytes a scan may leave mapped in before they are dropped
+#define FOLLOW_MS 20 // a busy writer gets looked at once per this, not once per write()
+
+static char *pg_name;
+static int pg_fd = -1; // open to see how big it got
+static const char *pg_map = NULL; // NULL while the file is empty
+static size_t pg_size = 0;
+static size_t *pg_marks = NULL; // pg_marks[k]: where line k * PAGER_MARK starts
+static long pg_nmarks = 0;
+static long pg_capmarks = 0;
+static long pg_lines = 0; // lines the index went past, all of them once pg_done
+static size_t pg_scan = 0; // where line pg_lines starts
+static int pg_done = 0;
+static size_t pg_faulted = 0; // bytes scanned since the map was last dropped
+static long pg_top = 0; // first line on screen
+static size_t pg_top_off = 0; // and where it starts
+static int pg_left = 0;
+static int pg_prompt = 0; // '/' search or ':' goto line while the bottom row takes the keys
+static char pg_input[SEARCH_MAX + 1];
+static int pg_len = 0;
+static char pg_note[SEARCH_MAX + 32]; // a message, until the next key
+static size_t pg_hit = 0; // last match, the next search goes on after it while it is on top
+static long pg_hit_line = -1;
+static int pg_follow = 0; // stick to the end as the file grows
+static struct TIMER *pg_grow_timer = NULL; // pg_grow() is due
+static size_t pg_tail = 0; // where the last line starts when it has no '\n' yet
+static size_t pg_bottom = 0; // end of the last row drawn, the end of the file shows if it's pg_size
+
+// the kernel can have back what a scan faulted in, it stays in the page cache anyway
+static void pg_forget(size_t bytes){
+	pg_faulted += bytes;
+	if (pg_faulted < PAGER_KEEP || pg_map == NULL) return;
+	madvise((void *) pg_map, pg_size, MADV_DONTNEED);
+	pg_faulted = 0;
+}
+
+// count lines on until line `line` and the byte at `off` are both behind the index, or the end is
+static void pg_index(long line, size_t off){
+	size_t from = pg_scan;
+	while (!pg_done && (pg_lines <= line || pg_scan <= off)){
+		if (pg_scan >= pg_size){
+			pg_done = 1;
+			break;
+		}
+		if (pg_lines % PAGER_MARK == 0){
+			if (pg_nmarks == pg_capmarks){
+				pg_capmarks = pg_capmarks > 0 ? pg_capmarks * 2 : 1024;
+				pg_marks = (size_t *) realloc(pg_marks, pg_capmarks * sizeof(size_t));
+				if (pg_marks == NULL) die("Failed at pg_index()");
+			}
+			pg_marks[pg_nmarks++] = pg_scan;
+		}
+		const char *nl = memchr(pg_map + pg_scan, '\n', pg_size - pg_scan);
+		if (nl == NULL) pg_tail = pg_scan;
+		pg_scan = nl != NULL ? nl - pg_map + 1 : pg_size;
+		pg_lines++;
+	}
+	pg_forget(pg_scan - from);
+}
+
+// where line *line starts, *line becomes the last line if the file is shorter than that
+static size_t pg_line_start(long *line){
+	pg_index(*line, 0);
+	if (*line >= pg_lines) *line = pg_lines > 0 ? pg_lines - 1 : 0;
+	if (pg_nmarks == 0) return 0;
+	size_t off = pg_marks[*line / PAGER_MARK];
+	for (long k = *line % PAGER_MARK; k > 0; k--)
+		off = (const char *) memchr(pg_map + off, '\n', pg_size - off) - pg_map + 1;
+	return off;
+}
+
+// the line the byte at off is on, and where that line starts
+static long pg_line_of(size_t off, size_t *start){
+	pg_index(0, off);
+	long lo = 0, hi = pg_nmarks - 1; // last checkpoint at or before off
+	while (lo < hi){
+		long mid = (lo + hi + 1) / 2;
+		if (pg_marks[mid] <= off) lo = mid;
+		else hi = mid - 1;
+	}
+	long line = lo * PAGER_MARK;
+	size_t at = pg_marks[lo];
+	const char *nl;
+	while ((nl = memchr(pg_map + at, '\n', off - at)) != NULL){
+		at = nl - pg_map + 1;
+		line++;
+	}
+	*start = at;
+	return line;
+}
+
+static void pg_goto(long line){
+	pg_top = line > 0 ? line : 0;
+	pg_top_off = pg_line_start(&pg_top);
+}
+
+// move the top line n lines down, or up for n < 0, as far as the file goes
+static void pg_scroll(long n){
+	for (; n > 0; n--){
+		const char *nl = memchr(pg_map + pg_top_off, '\n', pg_size - pg_top_off);
+		if (nl == NULL || nl + 1 == pg_map + pg_size) break; // this is the last line
+		pg_top_off = nl - pg_map + 1;
+		pg_top++;
+	}
+	for (; n < 0 && pg_top > 0; n++){
+		const char *nl = memrchr(pg_map, '\n', pg_top_off - 1); // skip the '\n' the line above ends with
+		pg_top_off = nl != NULL ? nl - pg_map + 1 : 0;
+		pg_top--;
+	}
+}
+
+// next match of pat after the last one, or from the top line, around the end if it has to
+static int pg_find(const char *pat){
+	size_t m = strlen(pat);
+	if (m == 0 || pg_size == 0) return 0;
+	size_t from = pg_hit_line == pg_top ? pg_hit + 1 : pg_top_off;
+	const char *p = find_in(pg_map + from, pg_size - from, pat, m);
+	if (p == NULL) p = find_in(pg_map, from + m - 1 < pg_size ? from + m - 1 : pg_size, pat, m);
+	pg_forget(p != NULL && p >= pg_map + from ? p - pg_map - from : pg_size);
+	if (p == NULL) return 0;
+	pg_hit = p - pg_map;
+	pg_top = pg_hit_line = pg_line_of(pg_hit, &pg_top_off);
+	struct LINE hit = {.len = pg_hit - pg_top_off, .gap = pg_hit - pg_top_off, .str = (char *) pg_map + pg_top_off};
+	int col = col_to_x(&hit, hit.len); // sideways too, if the match is off screen
+	if (col < pg_left || col + m > pg_left + screen_cols) pg_left = col > screen_cols / 2 ? col - screen_cols / 2 : 0;
+	return 1;
+}
+
+// the map follows the file to its new size, pages already there stay where they are
+static void pg_remap(size_t size){
+	if (size == 0){
+		if (pg_map != NULL) munmap((void *) pg_map, pg_size);
+		pg_map = NULL;
+	}
+	else if (pg_map == NULL) pg_map = (const char *) mmap(NULL, size, PROT_READ, MAP_SHARED, pg_fd, 0);
+#ifdef __linux__
+	else pg_map = (const char *) mremap((void *) pg_map, pg_size, size, MREMAP_MAYMOVE);
+#else
+	else {
+		munmap((void *) pg_map, pg_size);
+		pg_map = (const char *) mmap(NULL, size, PROT_READ, MAP_SHARED, pg_fd, 0);
+	}
+#endif
+	if (pg_map == MAP_FAILED) die("mmap error");
+	pg_size = size;
+}
+
+// the file changed size: map the new bytes and count lines on from where the index stopped
+static void pg_resize(size_t size){
+	int end_shown = pg_bottom >= pg_size;
+	if (size < pg_size){ // truncated, or rotated in place: nothing old is any good
+		pg_nmarks = pg_lines = 0;
+		pg_scan = pg_top_off = 0;
+		pg_top = 0;
+		pg_hit_line = -1;
+		snprintf(pg_note, sizeof(pg_note), "file truncated");
+	}
+	else if (pg_scan == pg_size && pg_size > 0 && pg_map[pg_size - 1] != '\n'){ // the last line goes on
+		pg_scan = pg_tail;
+		if (--pg_lines % PAGER_MARK == 0) pg_nmarks--;
+	}
+	pg_remap(size);
+	pg_done = 0;
+	if (pg_follow){
+		pg_index(LONG_MAX, 0); // only the new part
+		pg_goto(pg_lines - text_rows());
+	}
+	if (pg_follow || end_shown || pg_note[0]) screen_stale = 1;
+}
+
+// a busy writer's new bytes, once per FOLLOW_MS
+static void pg_grow(void *arg){
+	pg_grow_timer = NULL;
+	struct stat st;
+	if (fstat(pg_fd, &st) == 0 && (size_t) st.st_size != pg_size) pg_resize(st.st_size);
+}
+
+// before anything reads the map: a file that got shorter is remapped now, not when the timer is up,
+// the pages past its end are gone and touching one is a SIGBUS. Growing can wait, the old bytes stay
+static void pg_check(){
+	struct stat st;
+	if (fstat(pg_fd, &st) == 0 && (size_t) st.st_size < pg_size) pg_resize(st.st_size);
+}
+
+// inotify says the file was written: drain it, a shrink is taken in now and growth when the timer is up
+void pager_watch(){
+#ifdef __linux__
+	char events[4096];
+	while (read(watch_fd, events, sizeof(events)) > 0){}
+#endif
+	pg_check();
+	if (pg_grow_timer == NULL) pg_grow_timer = timer_add(FOLLOW_MS, 0, pg_grow, NULL);
+}
+
+// no inotify: ask for the size now and then
+static void pg_poll_size(void *arg){
+	pager_watch();
+}
+
+// map the file, look at it until CTRL-Q, nothing is ever written. follow: start at the end, and stay
+int pager_main(char *name, int follow){
+	pg_fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (pg_fd < 0) die("can't open the file");
+	struct stat st;
+	if (fstat(pg_fd, &st) < 0) die("fstat error");
+	pg_remap(st.st_size);
+	pg_name = name;
+	pager = 1;
+#ifdef __linux__
+	watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch_fd >= 0 && inotify_add_watch(watch_fd, name, IN_MODIFY) < 0){ // out of watches, or a filesystem without them
+		close(watch_fd);
+		watch_fd = -1;
+	}
+#endif
+	if (watch_fd < 0) timer_add(FOLLOW_MS * 5, FOLLOW_MS * 5, pg_poll_size, NULL); // a file is still worth paging without
+
+	if (tty_raw(STDIN_FILENO) < 0) die("tty_raw error");
+	screen_init();
+	if (follow) pager_key('F');
+	int why = event_loop();
+	printf("\n");
+
+	if (pg_map != NULL) munmap((void *) pg_map, pg_size);
+	if (watch_fd >= 0) close(watch_fd);
+	close(pg_fd);
+	free(pg_marks);
+	if (tty_reset(STDIN_FILENO) < 0) die("tty_reset error");
+	if (why == 0) die("read error");
+	if (why != 021){
+		printf("signal caught\n");
+		return 0;
+	}
+
+	clear_screen();
+	print_summary(name, pg_size, pg_done ? pg_lines : -1);
+	return 0;
+}
+
+// the screen straight from the map, the bottom row is the prompt or where we are
+void pager_draw(){
+	pg_check();
+	if (pg_prompt) snprintf(status_line, sizeof(status_line), "%s %s", pg_prompt == '/' ? "search:" : "line:", pg_input);
+	else if (pg_note[0]) snprintf(status_line, sizeof(status_line), "%s", pg_note);
+	else {
+		char total[32] = "?";
+		if (pg_done) snprintf(total, sizeof(total), "%ld", pg_lines);
+		snprintf(status_line, sizeof(status_line), "%s  line %ld of %s  %d%%%s", pg_name, pg_top + 1, total,
+			pg_size > 0 ? (int) (pg_top_off * 100 / pg_size) : 100, pg_follow ? "  (following)" : "");
+	}
+
+	int rows = text_rows();
+	size_t off = pg_top_off;
+	memset(pen_next, PEN_PLAIN, screen_rows * screen_cols); // no highlighting, nothing is lexed here
+	for (int r = 0; r < rows; r++){
+		unsigned *cells = frame_next + r * screen_cols;
+		if (off < pg_size){
+			const char *nl = memchr(pg_map + off, '\n', pg_size - off);
+			size_t end = nl != NULL ? nl - pg_map : pg_size;
+			draw_plain(cells, pg_map + off, end - off, pg_left);
+			off = end + 1;
+		}
+		else for (int i = 0; i < screen_cols; i++) cells[i] = ' ';
+	}
+	pg_bottom = off;
+	draw_status();
+	draw_stats();
+	int col = strlen(status_line);
+	frame_send(rows, pg_prompt && col < screen_cols ? col : 0);
+}
+
+// keys while the prompt is up, ENTER does the search or the goto
+static void pg_prompt_key(int c){
+	switch(c){
+		case 033: // ESC, never mind
+			pg_prompt = 0;
+			break;
+		case 127:
+		case 8:
+			if (pg_len > 0) pg_input[--pg_len] = '\0';
+			break;
+		case '\r':
+		case '\n':
+			if (pg_prompt == ':') pg_goto(atol(pg_input) - 1);
+			else {
+				if (pg_len > 0) strcpy(last_pat, pg_input);
+				if (last_pat[0] && !pg_find(last_pat)) snprintf(pg_note, sizeof(pg_note), "not found: %s", last_pat);
+			}
+			pg_prompt = 0;
+			break;
+		default:
+			if (c >= 32 && c < 256 && c != 127 && pg_len < SEARCH_MAX){
+				pg_input[pg_len++] = c;
+				pg_input[pg_len] = '\0';
+			}
+			break;
+	}
+}
+
+// keys of grid -R, there is nothing to edit so plain letters are commands too
+void pager_key(int c){
+	if (c == KEY_PASTE){ // typed faster than a frame, one at a time
+		for (int i = 0; i < paste_buf.len; i++) pager_key((unsigned char) paste_buf.b[i]);
+		return;
+	}
+	pg_note[0] = '\0';
+	pg_check();
+	if (pg_prompt){
+		pg_prompt_key(c);
+		return;
+	}
+	int page = text_rows() > 1 ? text_rows() - 1 : 1; // a line of the last page stays on screen
+	pg_follow = 0; // any other key looks somewhere else
+	switch(c){
+		case KEY_UP:
+			pg_scroll(-1);
+			break;
+		case KEY_DOWN:
+		case '\r':
+		case '\n':
+			pg_scroll(1);
+			break;
+		case KEY_PGUP:
+		case 'b':
+			pg_scroll(-page);
+			break;
+		case KEY_PGDN:
+		case ' ':
+			pg_scroll(page);
+			break;
+		case KEY_LEFT:
+			pg_left = pg_left > screen_cols / 2 ? pg_left - screen_cols / 2 : 0;
+			break;
+		case KEY_RIGHT:
+			pg_left += screen_cols / 2;
+			break;
+		case KEY_HOME:
+		case 'g':
+			pg_goto(0);
+			break;
+		case KEY_END:
+		case 'G': // the last page, this one counts every line
+			pg_index(LONG_MAX, 0);
+			pg_goto(pg_lines - text_rows());
+			break;
+		case 006: // CTRL-F
+		case '/':
+		case 007: // CTRL-G, goto line
+		case ':':
+			pg_prompt = c == 006 || c == '/' ? '/' : ':';
+			pg_len = 0;
+			pg_input[0] = '\0';
+			break;
+		case 'F': // follow: the last page now and whatever gets appended
+			pg_follow = 1;
+			pg_index(LONG_MAX, 0);
+			pg_goto(pg_lines - text_rows());
+			break;
+		case 016: // CTRL-N
+		case 'n':
+			if (last_pat[0] && !pg_find(last_pat)) snprintf(pg_note, sizeof(pg_note), "not found: %s", last_pat);
+			break;
+	}
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/*-------------------------------| WINDOWS - open files and views of them |------------------------*/
+/* every open file is a DOC and every window a WIN on one of them, windows stack top to bottom.
+ * Two windows on the same file share its DOC: the second view of a big file costs a WIN, the tree
+ * and the map are the same and an edit in one shows in the other. The code above works on doc and
+ * win, the window that has the keys; drawing and idle lexing point them at each window in turn
+ * with win_use(). The journal and the undo log stay globals of the document being edited:
+ * doc_enter() flushes them and parks them in the DOC it leaves, and takes out the parked ones of the
+ * DOC it goes to. CTRL-O opens a file in a new window (its DOC if it is open already), CTRL-E splits
+ * the window, CTRL-W goes to the next one and CTRL-X closes it. A file keeps its DOC after its last
+ * window is closed, CTRL-Q saves it with the others */
+#define NAME_MAX_LEN 400 // what the CTRL-O prompt takes, it has to fit on the status line
+
+struct PARKED{ // the journal and undo globals of a document that doesn't have the keys
+	char jn_name[4096];
+	int jn_fd;
+	struct ABUF jn_buf;
+	int jn_last;
+	long long jn_size;
+	long long jn_snap;
+	long long jn_file_size;
+	long long jn_file_mtime;
+	long jn_ops;
+	long jn_replayed;
+	struct ABUF undo_log;
+	int undo_top;
+	int undo_sealed;
+	int undo_grouping;
+};
+
+static int open_active = 0; // the bottom row asks for a file name, keys go to open_key()
+static char open_name[NAME_MAX_LEN + 1];
+static int open_len = 0;
+
+static void doc_park(struct PARKED *p){
+	memcpy(p->jn_name, jn_name, sizeof(jn_name));
+	p->jn_fd = jn_fd;
+	p->jn_buf = jn_buf;
+	p->jn_last = jn_last;
+	p->jn_size = jn_size;
+	p->jn_snap = jn_snap;
+	p->jn_file_size = jn_file_size;
+	p->jn_file_mtime = jn_file_mtime;
+	p->jn_ops = jn_ops;
+	p->jn_replayed = jn_replayed;
+	p->undo_log = undo_log;
+	p->undo_top = undo_top;
+	p->undo_sealed = undo_sealed;
+	p->undo_grouping = undo_grouping;
+}
+
+static void doc_unpark(struct PARKED *p){
+	memcpy(jn_name, p->jn_name, sizeof(jn_name));
+	jn_fd = p->jn_fd;
+	jn_buf = p->jn_buf;
+	jn_last = p->jn_last;
+	jn_size = p->jn_size;
+	jn_snap = p->jn_snap;
+	jn_file_size = p->jn_file_size;
+	jn_file_mtime = p->jn_file_mtime;
+	jn_ops = p->jn_ops;
+	jn_replayed = p->jn_replayed;
+	undo_log = p->undo_log;
+	undo_top = p->undo_top;
+	undo_sealed = p->undo_sealed;
+	undo_grouping = p->undo_grouping;
+}
+
+// give d the keys, the document that had them gets its journal written and parked
+static void doc_enter(struct DOC *d){
+	if (d == doc) return;
+	if (doc != NULL){
+		jn_flush(); // nothing waits in a parked journal
+		undo_sealed = 1;
+		doc_park(doc->parked);
+	}
+	doc = d;
+	doc_unpark(d->parked);
+}
+
+// d couldn't be opened after all: it goes again, was gets the keys back. Nothing of d was edited,
+// its journal and undo log are still empty
+static void doc_drop(struct DOC *d, struct DOC *was){
+	if (loading && load_doc == d){ // the loader still builds its tree, why it failed stays on the status line
+		char why[sizeof(status_line)];
+		memcpy(why, status_line, sizeof(why));
+		load_cancel();
+		memcpy(status_line, why, sizeof(why));
+	}
+	struct DOC **p = &docs;
+	while (*p != d) p = &(*p)->next;
+	*p = d->next;
+	if (was != NULL) doc_enter(was);
+	else doc = NULL;
+	if (d->buffer != NULL) tree_drop(d->buffer);
+	if (d->file_map != NULL) munmap(d->file_map, d->file_map_size);
+	free(d->parked);
+	free(d->name);
+	free(d);
+}
+
+// the document of file name, opened and loaded if it isn't open yet. Another name for the
+// same file (a link, ./name) finds the same one. NULL if it can't be, the status line says why
+static struct DOC *doc_open(const char *name){
+	struct stat st, ds;
+	int exists = stat(name, &st) == 0;
+	struct DOC **tail = &docs;
+	for (; *tail != NULL; tail = &(*tail)->next){
+		struct DOC *d = *tail;
+		if (strcmp(d->name, name) == 0) return d;
+		if (exists && stat(d->name, &ds) == 0 && ds.st_dev == st.st_dev && ds.st_ino == st.st_ino) return d;
+	}
+
+	// only a file that isn't there is new: one that can't be read would be saved over, empty
+	FILE *fp = fopen(name, "rb");
+	const char *why = NULL;
+	if (fp == NULL && errno != ENOENT) why = strerror(errno);
+	else if (fp != NULL && (fstat(fileno(fp), &st) < 0 || !S_ISREG(st.st_mode))) why = "not a regular file";
+	if (why != NULL){
+		if (fp != NULL) fclose(fp);
+		snprintf(status_line, sizeof(status_line), "%.*s: %s", NAME_MAX_LEN, name, why);
+		return NULL;
+	}
+
+	struct DOC *d = (struct DOC *) calloc(1, sizeof(struct DOC));
+	struct PARKED *p = (struct PARKED *) calloc(1, sizeof(struct PARKED));
+	if (d == NULL || p == NULL || (d->name = strdup(name)) == NULL) die("Failed at doc_open()");
+	d->hl_from = INT_MAX;
+	d->hl_to = -1;
+	p->jn_fd = p->jn_last = -1;
+	p->undo_sealed = 1;
+	d->parked = p;
+	*tail = d;
+
+	struct DOC *was = doc;
+	doc_enter(d); // what gets loaded and replayed below goes to d
+	double was_load = load_ms, was_first = first_ms;
+	if (loading) file_to_buffer(fp); // one loader at a time, it is still busy with another file
+	else file_to_buffer_bg(fp); // the first screen of it, the loader does the rest. NULL: new file
+	if (fp != NULL) fclose(fp); // now we close the file, don't need it for now
+	if (d != docs){ // load times printed at exit are the first file's
+		load_ms = was_load;
+		first_ms = was_first;
+	}
+	if (d->buffer != NULL){
+		hl_pick(d->name);
+		if (jn_recover(d->name) == 0) return d; // edits a crash left in the swap file go back on
+	}
+	doc_drop(d, was);
+	return NULL;
+}
+
+// a new window on d, under the one that has the keys
+static struct WIN *win_new(struct DOC *d){
+	struct WIN *w = (struct WIN *) calloc(1, sizeof(struct WIN));
+	if (w == NULL) die("Failed at win_new()");
+	w->doc = d;
+	if (win == NULL) wins = w;
+	else {
+		w->next = win->next;
+		win->next = w;
+	}
+	return w;
+}
+
+// w gets the keys, its cursor goes back inside the text if edits in another window took it away
+static void win_enter(struct WIN *w){
+	win = w;
+	doc_enter(w->doc);
+	if (win->cur.row >= doc->buf_line_no) win->cur.row = doc->buf_line_no - 1;
+	struct LINE *line = line_at(doc->buffer, win->cur.row);
+	if (win->cur.col > line->len) win->cur.col = line->len;
+	win->cur.col = col_snap(line, win->cur.col);
+}
+
+// is there room for one more window, a text row and a bar each. Says so if there isn't
+static int win_room(){
+	int n = 1;
+	for (struct WIN *w = wins; w != NULL; w = w->next) n++;
+	if (text_rows() / n >= 2) return 1;
+	snprintf(status_line, sizeof(status_line), "no room for another window");
+	return 0;
+}
+
+// CTRL-E: a second window on the same file, where this one is
+static void win_split(){
+	if (!win_room()) return;
+	struct WIN *w = win_new(doc);
+	w->cur = win->cur;
+	w->view = win->view;
+	win_enter(w);
+}
+
+// file name in a new window, a window on what is open already if it is
+static void win_open(const char *name){
+	if (!win_room()) return;
+	struct WIN *at = win;
+	struct DOC *d = doc_open(name);
+	win = at; // doc_open() gave d the keys, the window comes now
+	if (d == NULL) return; // the windows stay as they are, the status line says why
+	win_enter(win_new(d));
+}
+
+// CTRL-X: the window goes, the one below it (or the top one) gets the keys
+static void win_close(){
+	if (wins->next == NULL){
+		snprintf(status_line, sizeof(status_line), "the last window, CTRL-Q quits");
+		return;
+	}
+	struct WIN **p = &wins;
+	while (*p != win) p = &(*p)->next;
+	*p = win->next;
+	struct WIN *next = win->next != NULL ? win->next : wins;
+	free(win);
+	win_enter(next);
+}
+
+// a row went in at row (delta 1) or out (-1): the other windows on doc stay on their text
+void win_rows(int row, int delta){
+	for (struct WIN *w = wins; w != NULL; w = w->next){
+		if (w == win || w->doc != doc) continue;
+		if (delta > 0 ? w->cur.row >= row : w->cur.row >= row && w->cur.row > 0) w->cur.row += delta;
+		if (delta > 0 ? w->view.top >= row : w->view.top > row) w->view.top += delta;
+	}
+}
+
+static void open_status(){
+	snprintf(status_line, sizeof(status_line), "open: %s", open_name);
+}
+
+// CTRL-O: the prompt takes over the bottom row
+static void open_start(){
+	open_active = 1;
+	open_len = 0;
+	open_name[0] = '\0';
+	open_status();
+}
+
+// keys while the prompt is up, ENTER opens the file in a window under this one
+// is a prompt on the status line: search, regex or open. Nothing else writes over it then
+int prompt_active(){
+	return search_active || regex_active || open_active;
+}
+
+static int open_key(int c){
+	switch(c){
+		case 033: // ESC, never mind
+			open_active = 0;
+			status_line[0] = '\0';
+			return 1;
+		case 127:
+		case 8:
+			if (open_len > 0) open_name[--open_len] = '\0';
+			break;
+		case '\r':
+		case '\n':
+			open_active = 0;
+			status_line[0] = '\0';
+			if (open_len > 0) win_open(open_name);
+			return 1;
+		case KEY_PASTE:
+			for (int i = 0; i < paste_buf.len && open_len < NAME_MAX_LEN; i++)
+				if ((unsigned char) paste_buf.b[i] >= 32) open_name[open_len++] = paste_buf.b[i];
+			open_name[open_len] = '\0';
+			break;
+		default:
+			if (c >= 32 && c < 256 && c != 127 && open_len < NAME_MAX_LEN){
+				open_name[open_len++] = c;
+				open_name[open_len] = '\0';
+			}
+			break;
+	}
+	open_status();
+	return 1;
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+/* process one decoded key, only the buffer and cursor change here, the main loop redraws */
+// an edit is about to happen: journal it and log it for undo
+static void note_insert(int row, int col, const char *s, int n){
+	hl_edit(row);
+	jn_insert(row, col, s, n);
+	undo_insert(row, col, s, n);
+}
+
+static void note_delete(int row, int col, int n){
+	hl_edit(row);
+	jn_delete(row, col, n);
+	undo_delete(row, col, n);
+}
+
+// to row, onto the char drawn where the cursor is now: up and down go straight across wide chars
+static void cursor_row(int row){
+	int x = col_to_x(line_at(doc->buffer, win->cur.row), win->cur.col);
+	win->cur.row = row;
+	win->cur.col = x_to_col(line_at(doc->buffer, win->cur.row), x);
+}
+
+void handle_input(int c){
+	if (pager){
+		pager_key(c);
+		return;
+	}
+	if (search_active && search_key(c)) return;
+	if (open_active && open_key(c)) return;
+	if (regex_active && regex_key(c)) return;
+	status_line[0] = '\0'; // a message lasts until the next key
+	int editing = c == 127 || c == 8 || c == KEY_DEL || c == KEY_PASTE || c == '\r' || c == '\n'
+		|| (c >= 0 && c < 256 && is_text(c));
+	if (!editing) undo_sealed = 1; // moved around, the next edit is an undo step of its own
+
+	switch(c){
+
+		case KEY_UP:
+			if (win->cur.row > 0) cursor_row(win->cur.row - 1);
+			break;
+		case KEY_DOWN:
+			load_wait(win->cur.row + 1); // only this far, if the loader isn't there yet
+			if (win->cur.row < doc->buf_line_no - 1) cursor_row(win->cur.row + 1); // the viewport scrolls along
+			break;
+		case KEY_PGUP:
+			cursor_row(win->cur.row > win->rows ? win->cur.row - win->rows : 0);
+			break;
+		case KEY_PGDN: // a page is as high as the window
+			load_wait(win->cur.row + win->rows);
+			cursor_row(win->cur.row + win->rows < doc->buf_line_no ? win->cur.row + win->rows : doc->buf_line_no - 1);
+			break;
+		case KEY_RIGHT: // a whole char, marks and all
+			win->cur.col = col_next(line_at(doc->buffer, win->cur.row), win->cur.col);
+			break;
+		case KEY_LEFT:
+			win->cur.col = col_prev(line_at(doc->buffer, win->cur.row), win->cur.col);
+			break;
+		case KEY_HOME:
+			win->cur.col = 0;
+			break;
+		case KEY_END:
+			win->cur.col = line_at(doc->buffer, win->cur.row)->len;
+			break;
+		case KEY_DEL: // delete the char under the cursor: step over it and backspace
+			load_wait(win->cur.row + 1); // the line to join may still be on its way
+			if (win->cur.col < line_at(doc->buffer, win->cur.row)->len){
+				int cp;
+				win->cur.col += line_cp(line_at(doc->buffer, win->cur.row), win->cur.col, &cp);
+			}
+			else if (win->cur.row < doc->buf_line_no - 1){
+				win->cur.row++;
+				win->cur.col = 0;
+			}
+			else break;
+			// fall through
+		case 127: // DELETE or BACKSPACE
+		case 8: // this the same as BACKSPACE
+			if (win->cur.col > 0){ // the code point before the cursor, all of its bytes
+				int k = win->cur.col - cp_before(line_at(doc->buffer, win->cur.row), win->cur.col);
+				note_delete(win->cur.row, win->cur.col - k, k);
+				win->cur.col -= del_cols(line_at(doc->buffer, win->cur.row), c, win->cur.col);
+			}
+			else if (win->cur.row > 0){ // at the start of a line, glue it to the end of the one above
+				win->cur.col = line_at(doc->buffer, win->cur.row - 1)->len;
+				note_delete(win->cur.row - 1, win->cur.col, 1); // the '\n'
+				join_lines(--win->cur.row);
+			}
+			break;
+		case 006: // CTRL-F, find
+			search_start();
+			break;
+		case 017: // CTRL-O, open a file in a window of its own
+			open_start();
+			break;
+#ifdef GRID_STATS
+		case 024: // CTRL-T, the stats overlay on and off
+			stats_shown = !stats_shown;
+			break;
+#endif
+		case 005: // CTRL-E, split the window
+			win_split();
+			break;
+		case 027: // CTRL-W, the next window down, the top one after the last
+			win_enter(win->next != NULL ? win->next : wins);
+			break;
+		case 030: // CTRL-X, close the window
+			win_close();
+			break;
+		case 022: // CTRL-R, regex replace all
+			regex_start();
+			break;
+		case 016: // CTRL-N, find the last pattern again
+			if (last_pat[0] && !search_next(last_pat))
+				snprintf(status_line, sizeof(status_line), "not found: %s", last_pat);
+			break;
+		case 032: // CTRL-Z, undo
+		case 031: // CTRL-Y, redo
+			undo_step(c == 031, &win->cur);
+			break;
+		case '\r': // ENTER
+		case '\n': // ENTER
+			note_insert(win->cur.row, win->cur.col, "\n", 1);
+			split_line(win->cur.row, win->cur.col); // whatever is after the cursor goes down a line
+			win->cur.row++;
+			win->cur.col = 0;
+			break;
+		case KEY_PASTE: // a paste, or a burst of typing, all in one insert
+			note_insert(win->cur.row, win->cur.col, paste_buf.b, paste_buf.len);
+			insert_text(win->cur.row, win->cur.col, paste_buf.b, paste_buf.len, &win->cur);
+			break;
+		default: // Regular characters
+			if (c >= 0 && c < 256 && is_text(c)){
+				char ch = c;
+				note_insert(win->cur.row, win->cur.col, &ch, 1);
+				add_cols(line_at(doc->buffer, win->cur.row), c, win->cur.col++);
+			}
+			break; // other control keys do nothing, yet
+	} // end of switch
+
+	if (win->cur.col > line_at(doc->buffer, win->cur.row)->len) // to not exceed limit travel, like VIM
+		win->cur.col = line_at(doc->buffer, win->cur.row)->len;
+	win->cur.col = col_snap(line_at(doc->buffer, win->cur.row), win->cur.col); // never inside a code point
+}
+
+/* get current file size -- IGNORE THIS FOR NOW */
+long get_file_size(char* file_name){
+	FILE* fp = fopen(file_name, "rb");
+	
+	if (fp == NULL) return 0; // there is nothing so ...
+	
+	fseek(fp, 0L, SEEK_END); // go to the end
+	
+	long res = ftell(fp); // get file size
+	
+	fclose(fp);
+	
+	return res;
+}
+
+/*-------------------------------| REPLAY - grid --replay, typing latency without a tty |-----------*/
+/* grid --replay keys file [pty] opens file the way grid does and feeds it the bytes of keys (- is
+ * stdin, a file or a pipe) one key at a time, the way a tty hands over keys typed by hand. Each key
+ * goes through input_key() and handle_input() and is followed by its frame; the time from the key
+ * to the end of the frame's write() is the latency of that key. Between keys the idle work and
+ * the timers get what a typist leaves them, REPLAY_GAP_MS, untimed. Frames go to /dev/null, or to a
+ * pty a thread reads away. At the end one JSON line goes to stdout: latency p50/p99/max, bytes to
+ * the terminal and syscalls per key. Syscalls are the read and write calls the kernel counted for
+ * the main thread in /proc/thread-self/io, on systems without it only the write()s of the frames. The file is not saved and
+ * the swap file is removed */
+#define REPLAY_GAP_MS 50
+#define REPLAY_ROWS 24 // screen of a replay, unless LINES and COLUMNS say otherwise
+#define REPLAY_COLS 80
+
+struct SINK{ // where stdout went, see sink_open()
+	int saved; // the stdout from before
+	int fd;
+	int master; // pty only, -1 otherwise
+	pthread_t drain;
+};
+
+
+// the pty side nobody looks at, read so frames never wait on a full tty
+static void *sink_drain(void *arg){
+	char buf[65536];
+	while (read(*(int *) arg, buf, sizeof(buf)) > 0);
+	return NULL;
+}
+
+// frames go to /dev/null for a while, or to a raw pty of rows x cols if pty. sink_close() puts
+// stdout back
+static void sink_open(struct SINK *s, int pty, int rows, int cols){
+	s->master = -1;
+	if (pty){
+		s->master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (s->master < 0 || grantpt(s->master) < 0 || unlockpt(s->master) < 0) die("no pty");
+		s->fd = open(ptsname(s->master), O_RDWR | O_NOCTTY);
+		if (s->fd < 0) die("no pty");
+		struct termios raw;
+		tcgetattr(s->fd, &raw);
+		cfmakeraw(&raw);
+		tcsetattr(s->fd, TCSANOW, &raw);
+		struct winsize size = {rows, cols, 0, 0};
+		ioctl(s->fd, TIOCSWINSZ, &size);
+		if (pthread_create(&s->drain, NULL, sink_drain, &s->master) != 0) die("no pty thread");
+	}
+	else if ((s->fd = open("/dev/null", O_WRONLY)) < 0) die("can't open /dev/null");
+	fflush(stdout);
+	s->saved = dup(STDOUT_FILENO);
+	dup2(s->fd, STDOUT_FILENO);
+	screen_rows = rows; // what screen_init() keeps when /dev/null has no size
+	screen_cols = cols;
+	screen_init();
+}
+
+static void sink_close(struct SINK *s){
+	dup2(s->saved, STDOUT_FILENO);
+	close(s->saved);
+	close(s->fd);
+	if (s->master >= 0){ // the slave is gone, read() in the drain thread fails and it returns
+		close(s->master);
+		pthread_join(s->drain, NULL);
+	}
+}
+
+// bytes of the key at s: an escape sequence, a whole bracketed paste, a UTF-8 char or one byte
+static int replay_key_len(const unsigned char *s, int n){
+	if (s[0] == '\033' && n > 2 && s[1] == 'O') return 3;
+	if (s[0] == '\033' && n > 2 && s[1] == '['){
+		int i = 2;
+		while (i < n && !(s[i] >= 0x40 && s[i] <= 0x7e)) i++;
+		if (i == n) return n;
+		if (i == 5 && memcmp(s, "\033[200~", 6) == 0){
+			const unsigned char *end = memmem(s, n, "\033[201~", 6);
+			return end != NULL ? end - s + 6 : n;
+		}
+		return i + 1;
+	}
+	int k = s[0] >= 0xf0 ? 4 : s[0] >= 0xe0 ? 3 : s[0] >= 0xc0 ? 2 : 1;
+	return k < n ? k : n;
+}
+
+// read and write calls of this thread so far, as the kernel counts them, -1 if it doesn't say.
+// The thread only: the pty drain thread reads what the editor writes, it isn't the editor
+static long long replay_syscalls(){
+	FILE *fp = fopen("/proc/thread-self/io", "r");
+	if (fp == NULL) return -1;
+	char line[128];
+	long long n, total = 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (sscanf(line, "syscr: %lld", &n) == 1 || sscanf(line, "syscw: %lld", &n) == 1) total += n;
+	fclose(fp);
+	return total;
+}
+
+static int replay_cmp(const void *a, const void *b){
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+// grid --replay keys file [pty]
+static int replay_main(const char *keys_name, const char *file, int pty){
+	struct ABUF keys = {NULL, 0, 0};
+	int fd = strcmp(keys_name, "-") == 0 ? STDIN_FILENO : open(keys_name, O_RDONLY);
+	if (fd < 0) die("can't open the keys");
+	char chunk[65536];
+	ssize_t got;
+	while ((got = read(fd, chunk, sizeof(chunk))) > 0) ab_append(&keys, chunk, got);
+	if (got < 0) die("can't read the keys");
+	int null = open("/dev/null", O_RDONLY);
+	if (null < 0) die("can't open /dev/null");
+	dup2(null, STDIN_FILENO); // a lone ESC waits on stdin for the rest of it, there is none
+	close(null);
+	if (fd != STDIN_FILENO) close(fd);
+
+	struct DOC *d = doc_open(file);
+	if (d == NULL) die(status_line);
+	win_enter(win_new(d));
+	load_wait(INT_MAX); // the whole file first, every run types into the same buffer
+	timer_add(JN_FLUSH_MS, JN_FLUSH_MS, jn_flush_timer, NULL);
+
+	int rows = getenv("LINES") != NULL ? atoi(getenv("LINES")) : REPLAY_ROWS;
+	int cols = getenv("COLUMNS") != NULL ? atoi(getenv("COLUMNS")) : REPLAY_COLS;
+	struct SINK sink;
+	sink_open(&sink, pty, rows > 0 ? rows : REPLAY_ROWS, cols > 0 ? cols : REPLAY_COLS);
+	refresh_screen(); // the first frame isn't a key's
+
+	double *lat = (double *) malloc((keys.len + 1) * sizeof(double));
+	if (lat == NULL) die("Failed at replay_main()");
+	int n = 0;
+	long long bytes = screen_bytes, writes = screen_writes, sys = replay_syscalls();
+	long long sys_self = replay_syscalls() - sys; // what looking costs, taken off below
+	sys += sys_self;
+	for (int off = 0, len; off < keys.len; off += len){
+		len = replay_key_len((unsigned char *) keys.b + off, keys.len - off);
+		memcpy(in_buf, keys.b + off, len);
+		in_pos = 0;
+		in_len = len;
+
+		double start = now_ms();
+		int c, quit = 0;
+		while ((c = input_key()) != KEY_NONE || in_pos < in_len){
+			if (c == 021) quit = 1; /* 021 = CTRL-Q */
+			else if (c != KEY_NONE) handle_input(c);
+		}
+		refresh_screen();
+		lat[n++] = now_ms() - start;
+		screen_stale = 0;
+		if (quit) break;
+
+		double until = now_ms() + REPLAY_GAP_MS; // the typist's pause, untimed
+		timer_run();
+		while (idle_count > 0 && now_ms() < until) idle_run();
+		if (screen_stale){
+			screen_stale = 0;
+			refresh_screen();
+		}
+	}
+	long long sys_end = replay_syscalls() - sys_self;
+	bytes = screen_bytes - bytes;
+	writes = screen_writes - writes;
+	sink_close(&sink);
+
+	qsort(lat, n, sizeof(double), replay_cmp);
+	int keyn = n > 0 ? n : 1;
+	printf("{\"replay\": \"%s\", \"file\": \"%s\", \"out\": \"%s\", \"keys\": %d, "
+		"\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, \"bytes\": %lld, \"bytes_key\": %.1f, "
+		"\"syscalls_key\": %.2f, \"writes_key\": %.2f}\n",
+		keys_name, file, pty ? "pty" : "null", n,
+		n > 0 ? lat[n / 2] * 1000 : 0.0, n > 0 ? lat[(long) n * 99 / 100] * 1000 : 0.0,
+		n > 0 ? lat[n - 1] * 1000 : 0.0, bytes, (double) bytes / keyn,
+		sys >= 0 && sys_end >= 0 ? (double)(sys_end - sys) / keyn : (double) writes / keyn,
+		(double) writes / keyn);
+
+	jn_remove(); // nothing of the replay stays behind, the file isn't saved either
+	free(lat);
+	free(keys.b);
+	free_buffer();
+	return 0;
+}
+/*-------------------------------------------------------------------------------------------------*/
+
+#ifdef GRID_BENCH
+/*-------------------------------| BENCH - make bench, times the primitives |----------------------*/
+/* grid-bench is grid.c built with -DGRID_BENCH, main() hands over to bench_main() and the editor
+ * never starts. Every case prints one JSON object per line on stdout:
+ *   {"bench": "add_cols", "case": "middle", "size": 1024, "ops": 100000, "ns_op": 12.3, "mb_s": 77.5}
+ * size is what the case scales with (bytes of a file or a line, lines of a buffer, cells of the
+ * screen), mb_s counts the bytes the case moves: the file loaded or saved, the frames written, one
+ * per add_cols(). Files go in the directory given as the argument, /tmp if none, and are removed at
+ * the end. stdout of the run itself, the frames and what buffer_to_file() says, goes to /dev/null
+ * or to a pty so only the results are on the real one */
+#define BENCH_ROWS 50 // screen the redraw cases get
+#define BENCH_COLS 200
+
+static FILE *bench_out; // the real stdout, results only
+static struct DOC bench_doc;
+static struct WIN bench_win;
+
+static void bench_report(const char *bench, const char *name, long long size, long ops, double ms,
+	double bytes){
+	fprintf(bench_out, "{\"bench\": \"%s\", \"case\": \"%s\", \"size\": %lld, \"ops\": %ld, "
+		"\"ns_op\": %.1f, \"mb_s\": %.1f}\n", bench, name, size, ops, ms * 1e6 / ops,
+		ms > 0 ? bytes / (1024.0 * 1024.0) / (ms / 1000.0) : 0.0);
+	fflush(bench_out);
+}
+
+// a file of bytes bytes, lines of about line_len printable chars, the same every run
+static void bench_file(const char *path, long long bytes, int line_len){
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) die("bench: can't write the test file");
+	unsigned seed = 12345;
+	char line[4096];
+	for (long long done = 0; done < bytes; ){
+		seed = seed * 1103515245 + 12345;
+		int n = line_len / 2 + (seed >> 16) % (line_len + 1); // line_len/2 .. line_len*3/2
+		if (n > (int) sizeof(line) - 1) n = sizeof(line) - 1;
+		if (done + n + 1 > bytes) n = bytes - done - 1;
+		for (int i = 0; i < n; i++){
+			seed = seed * 1103515245 + 12345;
+			line[i] = (seed >> 16) % 7 == 0 ? ' ' : 'a' + (seed >> 16) % 26;
+		}
+		line[n] = '\n';
+		fwrite(line, 1, n + 1, fp);
+		done += n + 1;
+	}
+	if (fclose(fp) != 0) die("bench: can't write the test file");
+}
+
+// throw away what the last case built and load path into the bench document, returns the ms it took
+static double bench_load(const char *path){
+	free_buffer();
+	docs = doc = &bench_doc;
+	wins = win = &bench_win;
+	bench_doc.hl_valid = 0;
+	bench_doc.hl_from = INT_MAX;
+	bench_doc.hl_to = -1;
+	memset(&bench_win, 0, sizeof(bench_win));
+	bench_win.doc = doc;
+	FILE *fp = path != NULL ? fopen(path, "rb") : NULL;
+	if (path != NULL && fp == NULL) die("bench: can't read the test file");
+	double start = now_ms();
+	file_to_buffer(fp);
+	double ms = now_ms() - start;
+	if (doc->buffer == NULL) die(status_line);
+	if (fp != NULL) fclose(fp);
+	return ms;
+}
+
+// file_to_buffer() and buffer_to_file(), on a file nobody edited and on one with every 8th line
+// edited, so its lines are gap buffers and not slices of the map
+static void bench_files(const char *dir){
+	static const long long sizes[] = {1 << 20, 16 << 20, 128 << 20};
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/grid-bench-%d.txt", dir, (int) getpid());
+	for (int k = 0; k < 3; k++){
+		long long size = sizes[k];
+		long ops = (256LL << 20) / size < 3 ? 3 : (256LL << 20) / size;
+		bench_file(path, size, 64);
+		bench_load(path); // the first one pays for the page cache, the timed ones don't
+		double ms = 0;
+		for (long i = 0; i < ops; i++) ms += bench_load(path);
+		bench_report("file_to_buffer", "map", size, ops, ms, (double) size * ops);
+
+		ms = 0;
+		for (long i = 0; i < ops; i++){
+			double start = now_ms();
+			if (buffer_to_file(doc->buffer, path) < 0) die(save_error);
+			ms += now_ms() - start;
+		}
+		bench_report("buffer_to_file", "unedited", size, ops, ms, (double) size * ops);
+
+		for (int row = 0; row < doc->buf_line_no; row += 8){
+			struct LINE *line = line_at(doc->buffer, row);
+			add_cols(line, 'x', 0);
+			del_cols(line, 'x', 1);
+		}
+		ms = 0;
+		for (long i = 0; i < ops; i++){
+			double start = now_ms();
+			if (buffer_to_file(doc->buffer, path) < 0) die(save_error);
+			ms += now_ms() - start;
+		}
+		bench_report("buffer_to_file", "edited", size, ops, ms, (double) size * ops);
+	}
+	unlink(path);
+}
+
+// add_cols() then del_cols() at the start, the middle and the end of one long line. "jump" goes
+// from the start to the end and back on every op, so the gap moves across the whole line each time
+static void bench_cols(){
+	static const int sizes[] = {1 << 10, 32 << 10, 1 << 20};
+	static const char *names[] = {"start", "middle", "end", "jump"};
+	char *text = (char *) malloc(1 << 20);
+	if (text == NULL) die("bench: out of memory");
+	memset(text, 'a', 1 << 20);
+	for (int k = 0; k < 3; k++){
+		int size = sizes[k];
+		for (int w = 0; w < 4; w++){
+			long ops = w < 3 ? 100000 : (64L << 20) / size;
+			if (ops > 100000) ops = 100000;
+			bench_load(NULL);
+			struct LINE *line = line_at(doc->buffer, 0);
+			line_set(line, text, size);
+			double start = now_ms();
+			for (long i = 0; i < ops; i++){
+				int pos = w == 0 ? 0 : w == 1 ? line->len / 2 : w == 2 ? line->len : (i & 1) * line->len;
+				add_cols(line, 'x', pos);
+			}
+			double ms = now_ms() - start;
+			bench_report("add_cols", names[w], size, ops, ms, ops);
+			start = now_ms();
+			for (long i = 0; i < ops; i++){
+				int pos = w == 0 ? 1 : w == 1 ? line->len / 2 : w == 2 ? line->len : (i & 1) ? line->len : 1;
+				del_cols(line, 'x', pos);
+			}
+			ms = now_ms() - start;
+			bench_report("del_cols", names[w], size, ops, ms, ops);
+		}
+	}
+	free(text);
+}
+
+// add_rows() then del_rows() at the start, the middle and the end of buffers of 10K to 10M lines
+static void bench_rows(const char *dir){
+	static const int sizes[] = {10000, 100000, 1000000, 10000000};
+	static const char *names[] = {"start", "middle", "end"};
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/grid-bench-rows-%d.txt", dir, (int) getpid());
+	for (int k = 0; k < 4; k++){
+		bench_file(path, sizes[k] * 8LL, 6); // 7 bytes a line on average, a little over sizes[k] lines
+		bench_load(path);
+		while (doc->buf_line_no > sizes[k]) del_rows(&doc->buffer, doc->buf_line_no - 1);
+		while (doc->buf_line_no < sizes[k]) add_rows(&doc->buffer, doc->buf_line_no);
+		long ops = 100000;
+		for (int w = 0; w < 3; w++){
+			double start = now_ms();
+			for (long i = 0; i < ops; i++){
+				int row = w == 0 ? 0 : w == 1 ? doc->buf_line_no / 2 : doc->buf_line_no;
+				add_rows(&doc->buffer, row);
+			}
+			double ms = now_ms() - start;
+			bench_report("add_rows", names[w], sizes[k], ops, ms, 0);
+			start = now_ms();
+			for (long i = 0; i < ops; i++){
+				int row = w == 0 ? 0 : w == 1 ? doc->buf_line_no / 2 : doc->buf_line_no - 1;
+				del_rows(&doc->buffer, row);
+			}
+			ms = now_ms() - start;
+			bench_report("del_rows", names[w], sizes[k], ops, ms, 0);
+		}
+	}
+	unlink(path);
+}
+
+// a whole frame, drawn and sent: "full" repaints every cell as after a resize, "scroll" moves the
+// view down a line per frame so every row changes but the diff still runs
+static void bench_redraw(const char *dir, const char *target){
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/grid-bench-%d.txt", dir, (int) getpid());
+	bench_file(path, 4 << 20, 80);
+	bench_load(path);
+	unlink(path);
+
+	struct SINK sink;
+	sink_open(&sink, strcmp(target, "pty") == 0, BENCH_ROWS, BENCH_COLS);
+	refresh_screen();
+	long ops = 2000;
+	for (int full = 1; full >= 0; full--){
+		char name[64];
+		snprintf(name, sizeof(name), "%s/%s", full ? "full" : "scroll", target);
+		win->cur.row = win->view.top + win->rows - 1;
+		long long bytes = screen_bytes;
+		double start = now_ms();
+		for (long i = 0; i < ops; i++){
+			if (full) frame_valid = 0;
+			else win->cur.row++;
+			refresh_screen();
+		}
+		double ms = now_ms() - start;
+		bench_report("redraw", name, (long long) screen_rows * screen_cols, ops, ms, screen_bytes - bytes);
+	}
+
+	sink_close(&sink);
+}
+
+// make bench runs this instead of the editor: grid-bench [dir]
+static int bench_main(int argc, char *argv[]){
+	const char *dir = argc > 1 ? argv[1] : "/tmp";
+	int out = dup(STDOUT_FILENO);
+	bench_out = out >= 0 ? fdopen(out, "w") : NULL;
+	if (bench_out == NULL) die("bench: no stdout");
+	int null = open("/dev/null", O_WRONLY);
+	if (null < 0) die("bench: can't open /dev/null");
+	fflush(stdout);
+	dup2(null, STDOUT_FILENO); // buffer_to_file() prints what it did, that's not a result
+	close(null);
+
+	bench_files(dir);
+	bench_cols();
+	bench_rows(dir);
+	bench_redraw(dir, "null");
+	bench_redraw(dir, "pty");
+	free_buffer();
+	return 0;
+}
+/*-------------------------------------------------------------------------------------------------*/
+#endif
+
+// what grid says on its way out: the file, load and save, and the STATS table in a grid-stats.
+// lines < 0 when grid -R quit before it got to the end
+void print_summary(const char *name, long file_size, long lines){
+	if (lines >= 0) printf("%s: %ld bytes, %ld lines\n", name, file_size, lines);
+	else printf("%s: %ld bytes, not all lines counted\n", name, file_size);
+	if (doc != NULL){ // the editor, grid -R loads and saves nothing
+		printf("  first screen %10.3f ms\n", first_ms);
+		printf("  load         %10.3f ms  %8.1f MB/s\n", load_ms,
+			load_ms > 0 ? file_size / (1024.0 * 1024.0) / (load_ms / 1000.0) : 0.0);
+		printf("  save         %10.3f ms  %8.1f MB/s  %lld bytes\n", save_ms,
+			save_ms > 0 ? save_bytes / (1024.0 * 1024.0) / (save_ms / 1000.0) : 0.0, save_bytes);
+		printf("  edits        %10ld, %ld recovered from the swap file\n", jn_ops, jn_replayed);
+	}
+#ifdef GRID_STATS
+	printf("\n  %-10s %12s %12s %10s\n", "", "calls", "ms", "ns/call");
+	for (int k = 0; k < ST_COUNT; k++){
+		if (k == ST_ALLOC) printf("  %-10s %12lld\n", stat_names[k], stats[k].n);
+		else printf("  %-10s %12lld %12.3f %10.1f\n", stat_names[k], stats[k].n, stats[k].ms,
+			stats[k].n > 0 ? stats[k].ms * 1e6 / stats[k].n : 0.0);
+	}
+	long long frames = stats[ST_FRAME].n > 0 ? stats[ST_FRAME].n : 1;
+	printf("  written    %12lld bytes, %.1f a frame, in %lld write()s\n", screen_bytes,
+		(double) screen_bytes / frames, screen_writes);
+	printf("  rss        %12.1f MB\n", stat_rss() / (1024.0 * 1024.0));
+#endif
+}
+
+/* Main Method */
+int main(int argc, char *argv[]){
+#ifdef GRID_BENCH
+	return bench_main(argc, argv); // grid-bench, see BENCH
+#endif
+	if (argc <= 1) die("Oops we haven't implemented that yet"); // I will implement this logic later
+
+	// signals only write to the self-pipe, the event loop does the rest
+	if (pipe(sig_pipe) < 0) die("pipe error");
+	for (int k = 0; k < 2; k++){
+		fcntl(sig_pipe[k], F_SETFL, fcntl(sig_pipe[k], F_GETFL) | O_NONBLOCK);
+		fcntl(sig_pipe[k], F_SETFD, FD_CLOEXEC);
+	}
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART; // poll() wakes up through the pipe, nothing else needs EINTR
+	sa.sa_handler = sig_catch;
+	if (sigaction(SIGINT, &sa, NULL) < 0) die("sigaction(SIGINT) error");
+	if (sigaction(SIGQUIT, &sa, NULL) < 0) die("sigaction(SIGQUIT) error");
+	if (sigaction(SIGTERM, &sa, NULL) < 0) die("sigaction(SIGTERM) error");
+	sa.sa_handler = sig_winch;
+	if (sigaction(SIGWINCH, &sa, NULL) < 0) die("sigaction(SIGWINCH) error");
+
+	if (strcmp(argv[1], "-R") == 0 || strcmp(argv[1], "-F") == 0){ // read only, -F follows it as it grows
+		if (argc <= 2) die("usage: grid -R|-F file");
+		return pager_main(argv[2], argv[1][1] == 'F');
+	}
+	if (getenv("GRID_UNDO") != NULL) undo_limit = atol(getenv("GRID_UNDO")); // bytes of undo kept
+	if (strcmp(argv[1], "--replay") == 0){ // keys from a file, no tty, prints how long they took
+		if (argc <= 3) die("usage: grid --replay keys|- file [pty]");
+		return replay_main(argv[2], argv[3], argc > 4 && strcmp(argv[4], "pty") == 0);
+	}
+
+	long file_size = get_file_size(argv[1]);
+	struct DOC *first = doc_open(argv[1]); // the first window, on the file from the command line
+	if (first == NULL) die(status_line); // the terminal isn't raw yet
+	win_enter(win_new(first));
+	timer_add(JN_FLUSH_MS, JN_FLUSH_MS, jn_flush_timer, NULL);
+
+	// raw mode
+	if (tty_raw(STDIN_FILENO) < 0) die("tty_raw error");
+
+	screen_init();
+	ab_append(&screen_out, "\033[?2004h", 8); // bracketed paste on, goes out with the first frame
+	// first frame comes from the loop, cursor at OG position of 0 0 in the beginning
+	int why = event_loop();
+	printf("\033[?2004l\n"); // bracketed paste off again
+
+	char failed[4096] = ""; // saves that didn't work, told once the terminal is back
+	for (struct DOC *d = docs; d != NULL; d = d->next){
+		doc_enter(d);
+		if (why != 021 && why != 0) jn_flush(); // a signal: the swap file has everything, next start picks it up
+		else if (!(jn_ops > 0 || jn_replayed > 0)) jn_remove(); // untouched, a new one isn't made either
+		else if (buffer_to_file(doc->buffer, doc->name) == 0) jn_remove(); // now update the file
+		else{ // the others still get saved, this one keeps its swap file
+			jn_flush();
+			size_t n = strlen(failed);
+			snprintf(failed + n, sizeof(failed) - n, "%s not saved, %s. %s\n", doc->name, save_error,
+				jn_fd >= 0 ? "The edits are in its swap file" : "No swap file could be written either");
+		}
+	}
+	doc_enter(docs); // what gets printed below is about the file from the command line
+
+	free_buffer(); // free everything
+	
+	// reset to OG state and error checking
+	if (tty_reset(STDIN_FILENO) < 0) die("tty_reset error"); // reset to og setting		
+	if (failed[0] != '\0'){
+		fputs(failed, stderr);
+		return 1;
+	}
+	if (why == 0) die("read error");
+	if (why != 021){
+		printf("signal caught\n");
+		return 0;
+	}
+
+	clear_screen(); // clear screen again :)
+	print_summary(doc->name, file_size, doc->buf_line_no);
 
-	clear_screen(); // clear screen again :)
-	printf("****\n\nFILE SIZE IS: %d\n\n****\n", file_size);
-	printf("***\nbuffer line no: %d \n\n***\n", buf_line_no);
-	
 	return 0; 
 }
\ No newline at end of file